@@ -0,0 +1,706 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+// Benchmarks every bst backend against the standard containers and a sorted
+// vector, over several workloads, key types and sizes
+// Results go to stdout as a table and to a JSON file for later analysis
+//
+// Usage: bst_bench [--sizes 1000,1000000] [--reps 3] [--max-ops 1000000]
+//                  [--containers treap,std::map] [--keys int,string]
+//                  [--workloads find,zipf] [--json bst_bench.json]
+// Sizes up to 1e8 work but need several GB of memory per container
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../src/bst.h"
+#include "../src/stats_alloc.h"
+
+namespace {
+
+struct options {
+    std::vector<std::size_t> sizes{1000, 10000, 100000, 1000000};
+    std::size_t reps = 3;
+    std::size_t max_ops = 1000000;
+    std::vector<std::string> containers; // Empty means all
+    std::vector<std::string> keys;
+    std::vector<std::string> workloads;
+    std::string json_path = "bst_bench.json";
+};
+
+options opts;
+
+// Scans this many elements after the lower_bound of a range scan
+const std::size_t SCAN_LENGTH = 100;
+// Skew of the Zipf workload, as in YCSB
+const double ZIPF_THETA = 0.99;
+// Sorted vectors erase in O(n), so their erase workload is skipped past this
+const std::size_t MAX_VECTOR_ERASE_SIZE = 100000;
+
+auto now() {
+    return std::chrono::steady_clock::now();
+}
+
+auto nanos_elapsed(std::chrono::time_point<std::chrono::steady_clock> start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now() - start).count();
+}
+
+template<class T>
+void do_not_optimize(T &&value) {
+    asm volatile("" : : "r,m" (value) : "memory");
+}
+
+bool selected(const std::vector<std::string> &filter, std::string_view name) {
+    return filter.empty() || std::find(filter.begin(), filter.end(), name) != filter.end();
+}
+
+// Memory accounting
+
+// Every container allocates through this, so that the bytes held per element
+// and the allocations done per operation can be read back from its stats
+struct bench_tag {};
+
+template<class T>
+using counting_alloc = bst::stats_allocator<T, bench_tag>;
+
+std::uint64_t live_bytes() {
+    return counting_alloc<char>::stats().live_bytes;
+}
+
+std::uint64_t allocations() {
+    return counting_alloc<char>::stats().allocations;
+}
+
+// Keys and values
+
+struct large_value {
+    std::array<char, 256> bytes{};
+};
+
+// Keys are made from even numbers so that odd numbers give guaranteed misses
+template<class K>
+K make_key(std::uint64_t i);
+
+template<>
+int make_key<int>(std::uint64_t i) {
+    return static_cast<int>(i);
+}
+
+// 24 characters, so that the string never fits in the small string buffer
+// Hex of a scrambled i, so that neighbouring keys don't share long prefixes
+template<>
+std::string make_key<std::string>(std::uint64_t i) {
+    char buf[32];
+    std::snprintf(buf, sizeof buf, "key:%016llx%04llx",
+                  static_cast<unsigned long long>(i * 0x9E3779B97F4A7C15ULL),
+                  static_cast<unsigned long long>(i & 0xFFFF));
+    return buf;
+}
+
+template<class V>
+V make_value(std::uint64_t i) {
+    if constexpr (std::is_same_v<V, large_value>) {
+        large_value v;
+        v.bytes[0] = static_cast<char>(i);
+        return v;
+    } else {
+        return static_cast<V>(i);
+    }
+}
+
+// Ranks drawn from a Zipf distribution with Gray et al.'s method
+// ("Quickly generating billion-record synthetic databases"), as used by YCSB
+class zipf_distribution {
+public:
+    zipf_distribution(std::size_t n, double theta) : n(n), theta(theta) {
+        for (std::size_t i = 1; i <= n; i++) {
+            zeta_n += 1 / std::pow(static_cast<double>(i), theta);
+        }
+        const double zeta_2 = 1 + 1 / std::pow(2.0, theta);
+        alpha = 1 / (1 - theta);
+        eta = (1 - std::pow(2.0 / static_cast<double>(n), 1 - theta)) / (1 - zeta_2 / zeta_n);
+    }
+
+    template<class Gen>
+    std::size_t operator()(Gen &g) {
+        const double u = std::uniform_real_distribution<double>(0, 1)(g);
+        const double uz = u * zeta_n;
+        if (uz < 1) {
+            return 0;
+        }
+        if (uz < 1 + std::pow(0.5, theta)) {
+            return 1;
+        }
+        const auto rank = static_cast<std::size_t>(static_cast<double>(n) * std::pow(eta * u - eta + 1, alpha));
+        return std::min(rank, n - 1);
+    }
+
+private:
+    std::size_t n;
+    double theta;
+    double zeta_n = 0;
+    double alpha;
+    double eta;
+};
+
+// A sorted vector with just enough of the map/set interface for the workloads
+template<class K, class V, bool IsSet>
+class sorted_vector {
+public:
+    using value_type = std::conditional_t<IsSet, K, std::pair<K, V>>;
+    using storage = std::vector<value_type, counting_alloc<value_type>>;
+    using iterator = typename storage::iterator;
+
+    // Appends without sorting, see build()
+    void push_back(const value_type &value) {
+        data.push_back(value);
+    }
+
+    void build() {
+        std::sort(data.begin(), data.end(), less_value);
+        data.erase(std::unique(data.begin(), data.end(), [](const value_type &a, const value_type &b) {
+            return key_of(a) == key_of(b);
+        }), data.end());
+    }
+
+    std::pair<iterator, bool> insert(const value_type &value) {
+        auto it = lower_bound(key_of(value));
+        if (it != data.end() && key_of(*it) == key_of(value)) {
+            return {it, false};
+        }
+        return {data.insert(it, value), true};
+    }
+
+    iterator find(const K &key) {
+        auto it = lower_bound(key);
+        return it != data.end() && key_of(*it) == key ? it : data.end();
+    }
+
+    iterator lower_bound(const K &key) {
+        return std::lower_bound(data.begin(), data.end(), key, [](const value_type &a, const K &b) {
+            return key_of(a) < b;
+        });
+    }
+
+    std::size_t erase(const K &key) {
+        auto it = find(key);
+        if (it == data.end()) {
+            return 0;
+        }
+        data.erase(it);
+        return 1;
+    }
+
+    iterator begin() {
+        return data.begin();
+    }
+
+    iterator end() {
+        return data.end();
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return data.size();
+    }
+
+private:
+    static const K &key_of(const value_type &value) {
+        if constexpr (IsSet) {
+            return value;
+        } else {
+            return value.first;
+        }
+    }
+
+    static bool less_value(const value_type &a, const value_type &b) {
+        return key_of(a) < key_of(b);
+    }
+
+    storage data;
+};
+
+// Whether C has the bst range-walking API, for the range_walk workload
+struct ignore_value {
+    template<class U>
+    void operator()(U &&) const {}
+};
+
+template<class C, class K, class = void>
+struct has_for_each_in_range : std::false_type {};
+
+template<class C, class K>
+struct has_for_each_in_range<C, K, std::void_t<decltype(std::declval<C &>().for_each_in_range(
+        std::declval<const K &>(), std::declval<const K &>(), ignore_value{}))>> : std::true_type {};
+
+// Describes how to drive a container type
+template<class C, class K, class V, bool IsSet>
+struct container_traits {
+    static constexpr bool is_set = IsSet;
+    static constexpr bool is_sorted_vector = std::is_same_v<C, sorted_vector<K, V, IsSet>>;
+    static constexpr bool is_ordered = !std::is_same_v<C, std::unordered_map<K, V, std::hash<K>, std::equal_to<K>,
+            counting_alloc<std::pair<const K, V>>>>;
+
+    static constexpr bool has_range_walk = has_for_each_in_range<C, K>::value;
+
+    static void insert(C &c, const K &key, const V &value) {
+        if constexpr (IsSet) {
+            c.insert(key);
+        } else {
+            c.insert(typename C::value_type(key, value));
+        }
+    }
+};
+
+// Results
+
+struct result {
+    std::string container;
+    std::string key_type;
+    std::string workload;
+    std::size_t size;
+    std::size_t ops;
+    double median_ns;
+    double min_ns;
+    double bytes_per_element; // Only filled in by the insert workload, otherwise < 0
+    double allocs_per_op;
+};
+
+// Timings of every repetition of a workload, and how often it allocated
+struct measurement {
+    std::vector<double> samples;
+    double allocs_per_op = 0;
+};
+
+std::vector<result> results;
+
+void report(const std::string &container, const std::string &key_type, const std::string &workload,
+            std::size_t size, std::size_t ops, measurement m, double bytes_per_element = -1) {
+    std::vector<double> &samples = m.samples;
+    std::sort(samples.begin(), samples.end());
+    const result r{container, key_type, workload, size, ops,
+                   samples[samples.size() / 2], samples.front(), bytes_per_element, m.allocs_per_op};
+    std::printf("%-18s %-11s %-10s %10zu %10.1f ns/op (min %8.1f) %5.2f allocs/op", r.container.c_str(),
+                r.key_type.c_str(), r.workload.c_str(), r.size, r.median_ns, r.min_ns, r.allocs_per_op);
+    if (bytes_per_element >= 0) {
+        std::printf(" %7.1f bytes/element", bytes_per_element);
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+    results.push_back(r);
+}
+
+std::string json_escape(std::string_view s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+void write_json(const std::string &path) {
+    std::FILE *f = std::fopen(path.c_str(), "w");
+    if (f == nullptr) {
+        std::fprintf(stderr, "Could not open %s for writing\n", path.c_str());
+        std::exit(EXIT_FAILURE);
+    }
+    std::fprintf(f, "{\n  \"compiler\": \"%s\",\n", json_escape(__VERSION__).c_str());
+    std::fprintf(f, "  \"hardware_concurrency\": %u,\n", std::thread::hardware_concurrency());
+    std::fprintf(f, "  \"reps\": %zu,\n  \"results\": [\n", opts.reps);
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const result &r = results[i];
+        std::fprintf(f, "    {\"container\": \"%s\", \"key_type\": \"%s\", \"workload\": \"%s\", "
+                        "\"size\": %zu, \"ops\": %zu, \"median_ns_per_op\": %.2f, \"min_ns_per_op\": %.2f, "
+                        "\"allocs_per_op\": %.3f",
+                     json_escape(r.container).c_str(), json_escape(r.key_type).c_str(),
+                     json_escape(r.workload).c_str(), r.size, r.ops, r.median_ns, r.min_ns, r.allocs_per_op);
+        if (r.bytes_per_element >= 0) {
+            std::fprintf(f, ", \"bytes_per_element\": %.2f", r.bytes_per_element);
+        }
+        std::fprintf(f, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(f, "  ]\n}\n");
+    std::fclose(f);
+}
+
+// Workloads
+
+// Everything a workload needs for one size, generated once and shared by all
+// containers so they see exactly the same operations
+template<class K, class V>
+struct dataset {
+    std::vector<K> keys;        // Insertion order
+    std::vector<K> sorted;      // Key order
+    std::vector<K> hits;        // Present keys, uniformly chosen
+    std::vector<K> misses;      // Absent keys
+    std::vector<K> zipf;        // Present keys, Zipf-distributed by rank
+    std::vector<std::pair<int, K>> mixed; // 0 = find, 1 = insert, 2 = erase
+    std::vector<V> values;
+
+    dataset(std::size_t n, std::size_t ops) {
+        std::mt19937_64 g(n);
+        std::vector<std::uint64_t> ids(n);
+        std::iota(ids.begin(), ids.end(), 0);
+        std::shuffle(ids.begin(), ids.end(), g);
+        keys.reserve(n);
+        values.reserve(n);
+        for (std::uint64_t id : ids) {
+            keys.push_back(make_key<K>(2 * id));
+            values.push_back(make_value<V>(id));
+        }
+        sorted = keys;
+        std::sort(sorted.begin(), sorted.end());
+
+        std::uniform_int_distribution<std::uint64_t> pick(0, n - 1);
+        // Ranks map to a random key, so popularity doesn't follow key order
+        zipf_distribution zipf_rank(n, ZIPF_THETA);
+        for (std::size_t i = 0; i < ops; i++) {
+            hits.push_back(keys[pick(g)]);
+            misses.push_back(make_key<K>(2 * pick(g) + 1));
+            zipf.push_back(keys[zipf_rank(g)]);
+            // Finds hit present keys; inserts and erases churn over a key space
+            // twice the size, so the container stays about the same size
+            const auto op = static_cast<int>(g() % 4);
+            mixed.emplace_back(op < 2 ? 0 : op - 1, op < 2 ? keys[pick(g)] : make_key<K>(pick(g) * 2 + g() % 2));
+        }
+    }
+};
+
+// Fills an empty container with every key of data
+template<class C, class Traits, class K, class V>
+void fill(C &c, const dataset<K, V> &data) {
+    if constexpr (Traits::is_sorted_vector) {
+        for (std::size_t i = 0; i < data.keys.size(); i++) {
+            if constexpr (Traits::is_set) {
+                c.push_back(data.keys[i]);
+            } else {
+                c.push_back({data.keys[i], data.values[i]});
+            }
+        }
+        c.build();
+    } else {
+        for (std::size_t i = 0; i < data.keys.size(); i++) {
+            Traits::insert(c, data.keys[i], data.values[i]);
+        }
+    }
+}
+
+// Times body(c) over opts.reps repetitions on the same container
+template<class C, class Body>
+measurement time_reps(C &c, std::size_t ops, Body body) {
+    measurement m;
+    const std::uint64_t allocs_before = allocations();
+    for (std::size_t rep = 0; rep < opts.reps; rep++) {
+        const auto start = now();
+        body(c);
+        m.samples.push_back(static_cast<double>(nanos_elapsed(start)) / static_cast<double>(ops));
+    }
+    m.allocs_per_op = static_cast<double>(allocations() - allocs_before) / static_cast<double>(ops * opts.reps);
+    return m;
+}
+
+template<class C, class Traits, class K, class V>
+void run_container(const std::string &name, const std::string &key_type, const dataset<K, V> &data) {
+    const std::size_t n = data.keys.size();
+    const std::size_t ops = data.hits.size();
+
+    // Insert: sorted vectors are bulk-built (push_back + sort) instead
+    measurement m;
+    double bytes_per_element = 0;
+    for (std::size_t rep = 0; rep < opts.reps; rep++) {
+        const std::uint64_t bytes_before = live_bytes();
+        const std::uint64_t allocs_before = allocations();
+        C c;
+        const auto start = now();
+        fill<C, Traits>(c, data);
+        m.samples.push_back(static_cast<double>(nanos_elapsed(start)) / static_cast<double>(n));
+        bytes_per_element = static_cast<double>(live_bytes() - bytes_before) / static_cast<double>(c.size());
+        m.allocs_per_op = static_cast<double>(allocations() - allocs_before) / static_cast<double>(n);
+        do_not_optimize(c);
+    }
+    if (selected(opts.workloads, "insert")) {
+        report(name, key_type, "insert", n, n, m, bytes_per_element);
+    }
+
+    // Inserts in key order, the worst case for rotations
+    if constexpr (!Traits::is_sorted_vector) {
+        if (selected(opts.workloads, "insert_sorted")) {
+            m = {};
+            for (std::size_t rep = 0; rep < opts.reps; rep++) {
+                C sorted;
+                const std::uint64_t allocs_before = allocations();
+                const auto start = now();
+                for (std::size_t i = 0; i < n; i++) {
+                    Traits::insert(sorted, data.sorted[i], data.values[i]);
+                }
+                m.samples.push_back(static_cast<double>(nanos_elapsed(start)) / static_cast<double>(n));
+                m.allocs_per_op += static_cast<double>(allocations() - allocs_before) / static_cast<double>(n * opts.reps);
+                do_not_optimize(sorted);
+            }
+            report(name, key_type, "insert_sorted", n, n, m);
+        }
+    }
+
+    C c;
+    fill<C, Traits>(c, data);
+
+    if (selected(opts.workloads, "find")) {
+        report(name, key_type, "find", n, ops, time_reps(c, ops, [&](C &c) {
+            std::size_t found = 0;
+            for (const K &key : data.hits) {
+                found += c.find(key) != c.end();
+            }
+            do_not_optimize(found);
+        }));
+    }
+
+    if (selected(opts.workloads, "miss")) {
+        report(name, key_type, "miss", n, ops, time_reps(c, ops, [&](C &c) {
+            std::size_t found = 0;
+            for (const K &key : data.misses) {
+                found += c.find(key) != c.end();
+            }
+            do_not_optimize(found);
+        }));
+    }
+
+    if (selected(opts.workloads, "zipf")) {
+        report(name, key_type, "zipf", n, ops, time_reps(c, ops, [&](C &c) {
+            std::size_t found = 0;
+            for (const K &key : data.zipf) {
+                found += c.find(key) != c.end();
+            }
+            do_not_optimize(found);
+        }));
+    }
+
+    if (selected(opts.workloads, "iterate")) {
+        report(name, key_type, "iterate", n, n, time_reps(c, n, [&](C &c) {
+            std::size_t count = 0;
+            for (auto &value : c) {
+                do_not_optimize(value);
+                count++;
+            }
+            do_not_optimize(count);
+        }));
+    }
+
+    if constexpr (Traits::is_ordered) {
+        if (selected(opts.workloads, "range_scan")) {
+            const std::size_t scans = std::max<std::size_t>(1, ops / SCAN_LENGTH);
+            report(name, key_type, "range_scan", n, scans, time_reps(c, scans, [&](C &c) {
+                std::size_t count = 0;
+                for (std::size_t i = 0; i < scans; i++) {
+                    auto it = c.lower_bound(data.hits[i]);
+                    for (std::size_t j = 0; j < SCAN_LENGTH && it != c.end(); j++, ++it) {
+                        do_not_optimize(*it);
+                        count++;
+                    }
+                }
+                do_not_optimize(count);
+            }));
+        }
+    }
+
+    // The same scans through for_each_in_range, from each start to the key
+    // SCAN_LENGTH elements later
+    if constexpr (Traits::has_range_walk) {
+        if (selected(opts.workloads, "range_walk") && n > SCAN_LENGTH) {
+            const std::size_t scans = std::max<std::size_t>(1, ops / SCAN_LENGTH);
+            std::uniform_int_distribution<std::size_t> pick(0, n - SCAN_LENGTH - 1);
+            std::mt19937_64 g(n);
+            std::vector<std::size_t> starts(scans);
+            for (std::size_t &start : starts) {
+                start = pick(g);
+            }
+            report(name, key_type, "range_walk", n, scans, time_reps(c, scans, [&](C &c) {
+                std::size_t count = 0;
+                for (const std::size_t start : starts) {
+                    c.for_each_in_range(data.sorted[start], data.sorted[start + SCAN_LENGTH], [&](auto &value) {
+                        do_not_optimize(value);
+                        count++;
+                    });
+                }
+                do_not_optimize(count);
+            }));
+        }
+    }
+
+    if (selected(opts.workloads, "mixed") && !(Traits::is_sorted_vector && n > MAX_VECTOR_ERASE_SIZE)) {
+        report(name, key_type, "mixed", n, ops, time_reps(c, ops, [&](C &c) {
+            std::size_t found = 0;
+            std::size_t i = 0;
+            for (const auto &[op, key] : data.mixed) {
+                if (op == 0) {
+                    found += c.find(key) != c.end();
+                } else if (op == 1) {
+                    Traits::insert(c, key, data.values[i++ % n]);
+                } else {
+                    found += c.erase(key);
+                }
+            }
+            do_not_optimize(found);
+        }));
+    }
+
+    if (selected(opts.workloads, "erase") && !(Traits::is_sorted_vector && n > MAX_VECTOR_ERASE_SIZE)) {
+        m = {};
+        for (std::size_t rep = 0; rep < opts.reps; rep++) {
+            C victim;
+            fill<C, Traits>(victim, data);
+            const std::uint64_t allocs_before = allocations();
+            const auto start = now();
+            for (const K &key : data.keys) {
+                victim.erase(key);
+            }
+            m.samples.push_back(static_cast<double>(nanos_elapsed(start)) / static_cast<double>(n));
+            m.allocs_per_op += static_cast<double>(allocations() - allocs_before) / static_cast<double>(n * opts.reps);
+            do_not_optimize(victim);
+        }
+        report(name, key_type, "erase", n, n, m);
+    }
+}
+
+template<class C, class K, class V, bool IsSet = false>
+void run_if_selected(const std::string &name, const std::string &key_type, const dataset<K, V> &data) {
+    if (selected(opts.containers, name)) {
+        run_container<C, container_traits<C, K, V, IsSet>>(name, key_type, data);
+    }
+}
+
+template<class K, class V>
+void run_maps(const std::string &key_type) {
+    if (!selected(opts.keys, key_type)) {
+        return;
+    }
+    using alloc = counting_alloc<std::pair<const K, V>>;
+    for (std::size_t n : opts.sizes) {
+        const dataset<K, V> data(n, std::min(n, opts.max_ops));
+        run_if_selected<bst::treap_map<K, V, std::less<K>, alloc>>("treap", key_type, data);
+        run_if_selected<bst::impl::treap<K, V, std::less<K>, alloc, false, false, false>>("treap-bottom-up", key_type,
+                                                                                          data);
+        run_if_selected<bst::impl::treap<K, V, std::less<K>, alloc, false, false, true>>("treap-top-down", key_type,
+                                                                                         data);
+        run_if_selected<bst::adaptive_map<K, V, std::less<K>, alloc>>("adaptive", key_type, data);
+        run_if_selected<bst::filtered_map<K, V, std::less<K>, alloc>>("filtered", key_type, data);
+        run_if_selected<bst::indexed_map<K, V, std::less<K>, alloc>>("indexed", key_type, data);
+        run_if_selected<bst::avl_map<K, V, std::less<K>, alloc>>("avl", key_type, data);
+        run_if_selected<bst::rb_map<K, V, std::less<K>, alloc>>("red-black", key_type, data);
+        run_if_selected<bst::scapegoat_map<K, V, std::less<K>, alloc>>("scapegoat", key_type, data);
+        run_if_selected<std::map<K, V, std::less<K>, alloc>>("std::map", key_type, data);
+        run_if_selected<std::unordered_map<K, V, std::hash<K>, std::equal_to<K>, alloc>>("std::unordered_map", key_type, data);
+        run_if_selected<sorted_vector<K, V, false>>("sorted_vector", key_type, data);
+    }
+}
+
+void run_sets() {
+    const std::string key_type = "int_set";
+    if (!selected(opts.keys, key_type)) {
+        return;
+    }
+    using alloc = counting_alloc<int>;
+    for (std::size_t n : opts.sizes) {
+        const dataset<int, int> data(n, std::min(n, opts.max_ops));
+        run_if_selected<bst::treap_set<int, std::less<int>, alloc>, int, int, true>("treap", key_type, data);
+        run_if_selected<bst::impl::treap<int, bst::impl::null_type, std::less<int>, alloc, false, false, false>, int, int,
+                        true>("treap-bottom-up", key_type, data);
+        run_if_selected<bst::impl::treap<int, bst::impl::null_type, std::less<int>, alloc, false, false, true>, int, int,
+                        true>("treap-top-down", key_type, data);
+        run_if_selected<bst::filtered_set<int, std::less<int>, alloc>, int, int, true>("filtered", key_type, data);
+        run_if_selected<bst::avl_set<int, std::less<int>, alloc>, int, int, true>("avl", key_type, data);
+        run_if_selected<bst::rb_set<int, std::less<int>, alloc>, int, int, true>("red-black", key_type, data);
+        run_if_selected<bst::scapegoat_set<int, std::less<int>, alloc>, int, int, true>("scapegoat", key_type, data);
+        run_if_selected<std::set<int, std::less<int>, alloc>, int, int, true>("std::set", key_type, data);
+        run_if_selected<sorted_vector<int, int, true>, int, int, true>("sorted_vector", key_type, data);
+    }
+}
+
+std::vector<std::string> split_list(const char *arg) {
+    std::vector<std::string> out;
+    std::string item;
+    for (const char *p = arg; ; p++) {
+        if (*p == ',' || *p == '\0') {
+            if (!item.empty()) {
+                out.push_back(item);
+            }
+            item.clear();
+            if (*p == '\0') {
+                break;
+            }
+        } else {
+            item += *p;
+        }
+    }
+    return out;
+}
+
+void parse_args(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        if (i + 1 >= argc) {
+            std::fprintf(stderr, "Missing value for %s\n", argv[i]);
+            std::exit(EXIT_FAILURE);
+        }
+        const char *value = argv[++i];
+        if (arg == "--sizes") {
+            opts.sizes.clear();
+            for (const std::string &size : split_list(value)) {
+                // Through double so that 1e8 works
+                opts.sizes.push_back(static_cast<std::size_t>(std::stod(size)));
+            }
+        } else if (arg == "--reps") {
+            opts.reps = std::max<std::size_t>(1, std::stoul(value));
+        } else if (arg == "--max-ops") {
+            opts.max_ops = static_cast<std::size_t>(std::stod(value));
+        } else if (arg == "--containers") {
+            opts.containers = split_list(value);
+        } else if (arg == "--keys") {
+            opts.keys = split_list(value);
+        } else if (arg == "--workloads") {
+            opts.workloads = split_list(value);
+        } else if (arg == "--json") {
+            opts.json_path = value;
+        } else {
+            std::fprintf(stderr, "Unknown option %s\n", argv[i - 1]);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    parse_args(argc, argv);
+
+    run_maps<int, int>("int");
+    run_maps<std::string, int>("string");
+    run_maps<int, large_value>("large_value");
+    run_sets();
+
+    write_json(opts.json_path);
+    std::printf("Wrote %zu results to %s\n", results.size(), opts.json_path.c_str());
+    return 0;
+}
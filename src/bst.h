@@ -6,52 +6,556 @@
 #define BST_BST_H
 
 #include <cassert>  // assert
+#include <cerrno>   // EINTR, errno
 #include <climits>  // UINT32_MAX
+#include <cmath>    // std::log
 #include <cstddef>  // std::ptrdiff_t, std::size_t
+#include <cstdint>  // std::uint32_t, std::uint64_t
+#include <cstring>  // std::memcpy
+#if __has_include(<unistd.h>)
+#include <unistd.h> // read, write
+#define BST_HAS_FD 1
+#endif
+#if __cplusplus > 201703L && __has_include(<compare>)
+#include <compare>  // std::partial_ordering
+#endif
 
-#include <algorithm>   // std::less
-#include <iterator>    // std::bidirectional_iterator_tag, std::next, std::prev
-#include <memory>      // std::allocator, std::allocator_traits::{allocate, construct, deallocate, rebind_alloc}
+#include <algorithm>   // std::max, std::min, std::reverse, std::unique
+#include <atomic>      // std::atomic, std::memory_order_acq_rel, std::memory_order_relaxed
+#include <functional>  // std::greater, std::less
+#include <istream>     // std::istream
+#include <iterator>    // std::bidirectional_iterator_tag, std::distance, std::next, std::prev
+#include <memory>      // std::allocator, std::allocator_traits::{allocate, construct, deallocate, destroy, rebind_alloc}
+#include <mutex>       // std::lock_guard, std::mutex
+#include <optional>    // std::optional
+#include <ostream>     // std::ostream
 #include <random>      // std::minstd_rand
+#include <stdexcept>   // std::runtime_error
+#include <string>      // std::string
 #include <tuple>       // std::forward_as_tuple, std::ignore, std::make_tuple, std::tie, std::tuple
-#include <type_traits> // std::enable_if_t, std::is_const_v, std::is_same_v, std::remove_const_t, std::remove_cv_t
-#include <utility>     // std::pair, std::piecewise_construct
+#include <type_traits> // std::conditional_t, std::enable_if_t, std::invoke_result_t, std::is_arithmetic_v, std::is_base_of_v, std::is_const_v, std::is_convertible_v, std::is_empty_v, std::is_final_v, std::is_same_v, std::is_trivially_copyable_v, std::remove_const_t, std::remove_cv_t
+#include <utility>     // std::as_const, std::exchange, std::forward, std::move, std::pair, std::piecewise_construct, std::swap
+#include <vector>      // std::vector
+
+#include "filter.h"
+#include "hash_index.h"
+#include "thread_pool.h"
+
+// Define BST_STATS to non-zero to have every tree count the work it does,
+// see tree_stats. Off by default, in which case nothing is counted or stored
+#ifndef BST_STATS
+#define BST_STATS 0
+#endif
+
+// How treaps insert by default: BST_BOTTOM_UP links the new node in as a leaf
+// and rotates it up, BST_TOP_DOWN splits the tree where the new node belongs.
+// Either can also be picked per treap, see bst::impl::treap
+#define BST_BOTTOM_UP 0
+#define BST_TOP_DOWN 1
+
+#ifndef BST_TREAP_INSERT
+#define BST_TREAP_INSERT BST_BOTTOM_UP
+#endif
+
+// Records of more bytes than this go after the links in a node rather than
+// before them, see bst::impl::links_first
+#ifndef BST_LINKS_FIRST_ABOVE
+#define BST_LINKS_FIRST_ABOVE 64
+#endif
 
 namespace bst {
 
+// Work done by one tree since it was created or since reset_stats()
+struct tree_stats {
+    std::uint64_t comparisons{};
+    std::uint64_t nodes_visited{};   // By lookups
+    std::uint64_t rotations{};
+    std::uint64_t merge_steps{};     // Treaps only
+    std::uint64_t max_merge_depth{}; // Treaps only
+    std::uint64_t allocations{};
+    std::uint64_t deallocations{};
+};
+
+// Shape of a tree at the time shape() was called
+struct tree_shape {
+    std::size_t size{};
+    std::size_t height{};
+    std::vector<std::size_t> depth_histogram; // Number of nodes at each depth, the root being at depth 0
+    double average_path{};                    // Nodes visited by an average successful find()
+};
+
+// Thrown by load() when the stream doesn't hold a snapshot of a matching tree
+class snapshot_error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// How keys and mapped values are written to and read from snapshots
+// Trivially copyable types are copied as they are in memory and std::string
+// as its length and characters. Specialise it for any other type, with
+//     template<class Writer> static void write(Writer &out, const U &value);
+//     template<class Reader> static U read(Reader &in);
+// where out.write_bytes(const void *, std::size_t) and
+// in.read_bytes(void *, std::size_t) do the I/O
+template<class U, class Enable = void>
+struct serializer {
+    static_assert(sizeof(U) == 0, "specialise bst::serializer to save or load this type");
+};
+
+template<class U>
+struct serializer<U, std::enable_if_t<std::is_trivially_copyable_v<U>>> {
+    template<class Writer>
+    static void write(Writer &out, const U &value) {
+        out.write_bytes(&value, sizeof(U));
+    }
+
+    template<class Reader>
+    static U read(Reader &in) {
+        U res;
+        in.read_bytes(&res, sizeof(U));
+        return res;
+    }
+};
+
+template<>
+struct serializer<std::string> {
+    template<class Writer>
+    static void write(Writer &out, const std::string &value) {
+        const std::uint64_t size = value.size();
+        out.write_bytes(&size, sizeof size);
+        out.write_bytes(value.data(), value.size());
+    }
+
+    template<class Reader>
+    static std::string read(Reader &in) {
+        std::uint64_t size;
+        in.read_bytes(&size, sizeof size);
+        std::string res;
+        in.read_chunks(size, [&](const char *chars, std::size_t count) {
+            res.append(chars, count);
+        });
+        return res;
+    }
+};
+
 namespace impl {
 
+// Holds the tree_stats of a tree only when BST_STATS is on, so that it takes
+// no space otherwise (empty base optimisation)
+template<bool Enable = BST_STATS != 0>
+struct stats_holder {
+    static constexpr bool enabled = true;
+    tree_stats stats_;
+};
+
+template<>
+struct stats_holder<false> {
+    static constexpr bool enabled = false;
+};
+
+// Holds the comparator of a tree, taking no space when it is empty (empty base
+// optimisation), which is what every comparator without state is
+template<class Compare, bool Empty = std::is_empty_v<Compare> && !std::is_final_v<Compare>>
+struct compare_holder {
+    compare_holder() = default;
+
+    explicit compare_holder(const Compare &comp) : comp_(comp) {}
+
+    [[nodiscard]] const Compare &comparator() const noexcept {
+        return comp_;
+    }
+
+    Compare comp_;
+};
+
+template<class Compare>
+struct compare_holder<Compare, true> : private Compare {
+    compare_holder() = default;
+
+    explicit compare_holder(const Compare &comp) : Compare(comp) {}
+
+    [[nodiscard]] const Compare &comparator() const noexcept {
+        return *this;
+    }
+};
+
+// Holds the membership filter of a filtered tree, taking no space in others
+template<class Key, class Allocator, bool Enable>
+struct filter_holder {
+    static constexpr bool filtered = true;
+
+    explicit filter_holder(const Allocator &alloc) : filter_(alloc) {}
+
+    counting_filter<Key, Allocator> filter_;
+};
+
+template<class Key, class Allocator>
+struct filter_holder<Key, Allocator, false> {
+    static constexpr bool filtered = false;
+
+    explicit filter_holder(const Allocator &) {}
+};
+
+// Holds the hash index of an indexed tree, taking no space in others
+template<class Key, class Node, class Allocator, bool Enable>
+struct index_holder {
+    static constexpr bool indexed = true;
+
+    explicit index_holder(const Allocator &alloc) : index_(alloc) {}
+
+    hash_index<Key, Node, Allocator> index_;
+};
+
+template<class Key, class Node, class Allocator>
+struct index_holder<Key, Node, Allocator, false> {
+    static constexpr bool indexed = false;
+
+    explicit index_holder(const Allocator &) {}
+};
+
+// Comparators returning an ordering (e.g. std::compare_three_way) instead of
+// a bool are used as three-way comparators, which tell equivalent keys apart
+// in the same call. Needs C++20
+template<class Compare, class Key, class Enable = void>
+inline constexpr bool is_three_way = false;
+
+#if __cpp_lib_three_way_comparison >= 201907L
+template<class Compare, class Key>
+inline constexpr bool is_three_way<Compare, Key, std::enable_if_t<std::is_convertible_v<
+        std::invoke_result_t<const Compare &, const Key &, const Key &>, std::partial_ordering>>> = true;
+#endif
+
+// Snapshots go through a buffer, so that the stream or file descriptor sees a
+// few large sequential writes instead of several small ones per node
+class snapshot_writer {
+public:
+    explicit snapshot_writer(std::ostream &out) : out(&out) {
+        buf.reserve(BUFFER_SIZE);
+    }
+
+#ifdef BST_HAS_FD
+    explicit snapshot_writer(int fd) : fd(fd) {
+        buf.reserve(BUFFER_SIZE);
+    }
+#endif
+
+    void write_bytes(const void *bytes, std::size_t count) {
+        const auto *chars = static_cast<const char *>(bytes);
+        if (buf.size() + count > BUFFER_SIZE) {
+            flush();
+            if (count > BUFFER_SIZE) {
+                write_through(chars, count);
+                return;
+            }
+        }
+        buf.insert(buf.end(), chars, chars + count);
+    }
+
+    void flush() {
+        write_through(buf.data(), buf.size());
+        buf.clear();
+    }
+
+private:
+    static constexpr std::size_t BUFFER_SIZE = std::size_t{1} << 20;
+
+    void write_through(const char *chars, std::size_t count) {
+        if (out != nullptr) {
+            if (!out->write(chars, static_cast<std::streamsize>(count))) {
+                throw snapshot_error("bst: could not write snapshot");
+            }
+            return;
+        }
+#ifdef BST_HAS_FD
+        // write() may take only part of it, or be interrupted before taking any
+        while (count > 0) {
+            const auto written = ::write(fd, chars, count);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                throw snapshot_error("bst: could not write snapshot");
+            }
+            chars += written;
+            count -= static_cast<std::size_t>(written);
+        }
+#endif
+    }
+
+    std::ostream *out{};
+    [[maybe_unused]] int fd{-1};
+    std::vector<char> buf;
+};
+
+// Reads ahead a buffer at a time, so it may take more than the snapshot from
+// the stream or file descriptor
+class snapshot_reader {
+public:
+    explicit snapshot_reader(std::istream &in) : in(&in), buf(BUFFER_SIZE) {}
+
+#ifdef BST_HAS_FD
+    explicit snapshot_reader(int fd) : fd(fd), buf(BUFFER_SIZE) {}
+#endif
+
+    void read_bytes(void *bytes, std::size_t count) {
+        auto *dst = static_cast<char *>(bytes);
+        read_chunks(count, [&](const char *chars, std::size_t n) {
+            std::memcpy(dst, chars, n);
+            dst += n;
+        });
+    }
+
+    // Hands the next count bytes to consume(chars, n) a buffer at a time, so
+    // that a corrupt length can't make us allocate more than the stream holds
+    template<class Consume>
+    void read_chunks(std::uint64_t count, Consume consume) {
+        while (count > 0) {
+            if (pos == end) {
+                refill();
+            }
+            const auto n = static_cast<std::size_t>(std::min<std::uint64_t>(count, end - pos));
+            consume(buf.data() + pos, n);
+            pos += n;
+            count -= n;
+        }
+    }
+
+private:
+    static constexpr std::size_t BUFFER_SIZE = std::size_t{1} << 20;
+
+    void refill() {
+        pos = 0;
+        end = 0;
+        if (in != nullptr) {
+            in->read(buf.data(), static_cast<std::streamsize>(buf.size()));
+            end = static_cast<std::size_t>(in->gcount());
+        } else {
+#ifdef BST_HAS_FD
+            auto got = ::read(fd, buf.data(), buf.size());
+            while (got < 0 && errno == EINTR) {
+                got = ::read(fd, buf.data(), buf.size());
+            }
+            if (got < 0) {
+                throw snapshot_error("bst: could not read snapshot");
+            }
+            end = static_cast<std::size_t>(got);
+#endif
+        }
+        if (end == 0) {
+            throw snapshot_error("bst: snapshot is truncated");
+        }
+    }
+
+    std::istream *in{};
+    [[maybe_unused]] int fd{-1};
+    std::vector<char> buf;
+    std::size_t pos{};
+    std::size_t end{};
+};
+
+// Written at the start of every snapshot
+struct snapshot_header {
+    static constexpr char MAGIC[8] = {'B', 'S', 'T', 'S', 'N', 'A', 'P', '\0'};
+    static constexpr std::uint32_t VERSION = 1;
+    static constexpr std::uint32_t ORDER_MARK = 0x01020304;
+
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t key_size;
+    std::uint32_t mapped_size; // 0 for sets
+    std::uint32_t multi;
+    std::uint32_t reserved;
+    std::uint64_t count;
+};
+
+// Strings compared byte by byte are ordered like their first 8 bytes, read as
+// a big-endian integer, whenever those differ. Nodes that cache this prefix
+// next to their links let most steps of a lookup skip the string's heap buffer
+template<class Key, class Compare>
+inline constexpr bool use_key_prefix = std::is_same_v<Key, std::string>
+                                       && (std::is_same_v<Compare, std::less<std::string>>
+                                           || std::is_same_v<Compare, std::less<>>
+#if __cpp_lib_three_way_comparison >= 201907L
+                                           || std::is_same_v<Compare, std::compare_three_way>
+#endif
+                                       );
+
+// Arithmetic keys in their natural order compare in a single instruction, so
+// lookups can pick the next child with a conditional move instead of a branch
+// that goes either way at random
+template<class Key, class Compare>
+inline constexpr bool branchless_keys = std::is_arithmetic_v<Key>
+                                        && (std::is_same_v<Compare, std::less<Key>>
+                                            || std::is_same_v<Compare, std::less<>>
+                                            || std::is_same_v<Compare, std::greater<Key>>
+                                            || std::is_same_v<Compare, std::greater<>>);
+
+// Shorter strings are padded with 0s, so a tie can still go either way and
+// has to be settled by comparing the whole keys
+[[nodiscard]] inline std::uint64_t key_prefix(const std::string &key) noexcept {
+    unsigned char bytes[8]{};
+    std::memcpy(bytes, key.data(), std::min<std::size_t>(key.size(), sizeof bytes));
+    std::uint64_t res = 0;
+    for (unsigned char byte : bytes) {
+        res = res << 8 | byte;
+    }
+    return res;
+}
+
+// Hints that p is about to be read, so its cache line can be fetched while
+// we work on something else. p may be null
+inline void prefetch([[maybe_unused]] const void *p) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(p);
+#endif
+}
+
+template<bool CachePrefix>
+struct prefix_slot {};
+
+template<>
+struct prefix_slot<true> {
+    std::uint64_t prefix{};
+};
+
+// The largest end in the subtree, kept by interval treaps
+template<class T, bool Interval>
+struct interval_slot {};
+
+template<class T>
+struct interval_slot<T, true> {
+    T max_end{};
+};
+
+// The smallest and largest mapped values in the subtree, kept by priority maps
+template<class T, bool Prioritized>
+struct priority_slot {};
+
+template<class T>
+struct priority_slot<T, true> {
+    T min_pri{};
+    T max_pri{};
+};
+
 // We use template specialisation on this not void so user can't accidentally do
 // map<int, void> for instance
 struct null_type {};
 
-// TODO: 1. Extend with extra stuff like tree-order statistics
-template<class Key, class T, class Compare, class Allocator>
-class treap {
-private:
-    struct node;
+template<class U>
+inline constexpr auto is_null_type = std::is_same_v<U, null_type>;
 
-    template<class U>
-    struct treap_iter;
+template<class Key, class T, class Enable = void>
+struct value_type_of {};
 
-    template<class U>
-    static constexpr auto is_null_type = std::is_same_v<U, null_type>;
+template<class Key, class T>
+struct value_type_of<Key, T, std::enable_if_t<!is_null_type<T>>> { using type = std::pair<const Key, T>; };
 
-    template<class U, class Enable = void>
-    struct value_type_of {};
+template<class Key, class T>
+struct value_type_of<Key, T, std::enable_if_t<is_null_type<T>>> { using type = const Key; };
 
-    template<class U>
-    struct value_type_of<U, std::enable_if_t<!is_null_type<U>>> { using type = std::pair<const Key, T>; };
+template<class Node>
+struct node_links {
+    Node *left{};
+    Node *right{};
+    Node *par{};
+};
+
+template<class Value>
+struct node_record {
+    template<class V>
+    explicit node_record(V &&value) : record(std::forward<V>(value)) {}
+
+    Value record;
+};
+
+// Balancing data of a tree that keeps none in its nodes
+struct no_balance {};
+
+// The links of a node followed by the balancing data of its tree (priority,
+// height, colour...), which rotations and rebalancing read along with them
+template<class Node, class Balance>
+struct node_hot : node_links<Node>, Balance {};
+
+// Whether a node puts its links and balancing data before its record
+// A lookup reads the key and the links of every node on its way down and
+// nothing else, and an update the links and the balancing data of the nodes
+// it rotates, so with a large mapped value after the key, links that come
+// after the record would be a cache line or more away from the key. Putting
+// them first keeps them and the key together and leaves the rest of the
+// record to be read only by whoever uses it
+template<class Key, class T>
+inline constexpr bool links_first = sizeof(typename value_type_of<Key, T>::type) > BST_LINKS_FIRST_ABOVE;
+
+// The two parts of a node in the order links_first puts them in
+template<class Key, class T, class Node, class Balance>
+struct node_layout {
+    using record = node_record<typename value_type_of<Key, T>::type>;
+    using hot = node_hot<Node, Balance>;
+    using first = std::conditional_t<links_first<Key, T>, hot, record>;
+    using second = std::conditional_t<links_first<Key, T>, record, hot>;
+};
+
+// The part of a node that every tree shares: the record, the links and the
+// tree's own Balance data, the last two kept together
+template<class Key, class T, class Node, class Balance = no_balance>
+struct node_base : node_layout<Key, T, Node, Balance>::first, node_layout<Key, T, Node, Balance>::second {
+    using value_type = typename value_type_of<Key, T>::type;
+
+    explicit node_base(const value_type &value, Node *_par)
+            : node_record<value_type>(value) {
+        this->par = _par;
+        assert(static_cast<void *>(this) != this->par);
+    }
+
+    explicit node_base(value_type &&value, Node *_par)
+            : node_record<value_type>(std::move(value)) {
+        this->par = _par;
+        assert(static_cast<void *>(this) != this->par);
+    }
+
+    template<class U = T, std::enable_if_t<!is_null_type<U>, bool> = true>
+    [[nodiscard]] const Key &key() const {
+        return this->record.first;
+    }
+
+    template<class U = T, std::enable_if_t<is_null_type<U>, bool> = true>
+    [[nodiscard]] const Key &key() const {
+        return this->record;
+    }
+};
+
+// Code shared by all of the search trees below: lookups, the in-order
+// iterator, node allocation and the rotation primitives
+// Derived only has to provide insert_() and erase_(), which keep its own
+// balancing invariant
+// The header node is the end() sentinel: header.par is the root,
+// header.left is begin() and header.right is the rightmost node
+// With Filtered, a counting Bloom filter over the keys lets find() and
+// count() turn most keys that aren't there away without going down the tree.
+// With Indexed, a hash table from keys to nodes finds keys without going down
+// the tree at all, and lets insert() and operator[] find keys already there.
+// Either way keys have to have a std::hash under which equivalent keys hash
+// the same
+template<class Key, class T, class Compare, class Allocator, class Node, class Derived, bool Filtered = false,
+         bool Indexed = false>
+class bst_base : private stats_holder<>, private compare_holder<Compare>,
+                 private filter_holder<Key, Allocator, Filtered>, private index_holder<Key, Node, Allocator, Indexed> {
+protected:
+    using node = Node;
+    using filter_base = filter_holder<Key, Allocator, Filtered>;
+    using index_base = index_holder<Key, Node, Allocator, Indexed>;
 
     template<class U>
-    struct value_type_of<U, std::enable_if_t<is_null_type<U>>> { using type = const Key; };
+    struct tree_iter;
 
 public:
-    using value_type = typename value_type_of<T>::type;
+    using value_type = typename value_type_of<Key, T>::type;
     using size_type = std::size_t;
     using allocator_type = Allocator;
-    using iterator = treap_iter<node>;
-    using const_iterator = treap_iter<const node>;
+    using key_compare = Compare;
+    using iterator = tree_iter<node>;
+    using const_iterator = tree_iter<const node>;
 
 private:
     // Concepts checks
@@ -75,73 +579,162 @@ private:
 public:
     static_assert(!is_null_type<Key>, "class Key cannot be null_type");
 
-    treap() : header({}, {}) {
-        header.pri = UINT32_MAX;
+    bst_base() : bst_base(Compare()) {}
+
+    explicit bst_base(const Compare &comp, const Allocator &alloc = Allocator())
+            : compare_holder<Compare>(comp),
+              filter_base(alloc),
+              index_base(alloc),
+              header({}, {}),
+              allocator(alloc) {
         header.left = &header;
         header.right = &header;
         assert(header.par == nullptr);
     }
 
-    ~treap() {
+    ~bst_base() {
         if (root() != nullptr) {
             assert(!empty());
-            destroy_node(root());
+            destroy_tree();
         } else {
             assert(empty());
         }
+        release(allocator, arena_);
+    }
+
+    // Copies every node along with its balancing data, so the copy has the
+    // same shape as other. O(n)
+    // The header is copied too as some trees keep data in it (e.g. the
+    // treap's maximum priority)
+    // The filter isn't, as it is rebuilt as soon as it is needed, and the
+    // index is made up again as the nodes are
+    bst_base(const bst_base &other)
+            : compare_holder<Compare>(other),
+              filter_base(Allocator(other.allocator)),
+              index_base(Allocator(other.allocator)),
+              header(other.header),
+              allocator(std::allocator_traits<node_allocator>::select_on_container_copy_construction(other.allocator)) {
+        reset_header();
+        if (other.header.par != nullptr) {
+            try {
+                clone_into(header.par, other.header.par, &header);
+            } catch (...) {
+                destroy_node(header.par);
+                throw;
+            }
+            header.left = leftmost_of(header.par);
+            header.right = rightmost_of(header.par);
+        }
+    }
+
+    // Takes over the nodes of other, which is left empty. O(1)
+    bst_base(bst_base &&other) noexcept
+            : compare_holder<Compare>(other),
+              filter_base(Allocator(other.allocator)),
+              index_base(Allocator(other.allocator)),
+              header(other.header),
+              allocator(std::move(other.allocator)) {
+        reset_header();
+        swap_contents(other);
+    }
+
+    bst_base &operator=(const bst_base &other) {
+        if (this != &other) {
+            bst_base tmp(other);
+            swap_contents(tmp);
+        }
+        return *this;
+    }
+
+    bst_base &operator=(bst_base &&other) noexcept {
+        if (this != &other) {
+            bst_base tmp(std::move(other));
+            swap_contents(tmp);
+        }
+        return *this;
     }
 
-    // TODO: Fix the Big 5
+    // Swaps the balancing state the derived trees keep outside their nodes
+    // too (e.g. the scapegoat tree's size bound)
+    void swap(bst_base &other) noexcept {
+        swap_contents(other);
+        derived().swap_balance(static_cast<Derived &>(other));
+    }
 
     // Finds an element with key equivalent to key
     [[nodiscard]] iterator find(const Key &key) {
-        iterator lb = lower_bound(key);
-        return lb != end() && lb.node->key() == key ? lb : end();
+        if (!may_contain(key)) {
+            return end();
+        }
+        if constexpr (index_base::indexed) {
+            node *const n = indexed_node(key);
+            return n != nullptr ? iterator{n} : end();
+        }
+        const auto [it, found] = locate(key);
+        return found ? it : end();
     }
 
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "Simplify"
     // Returns an iterator pointing to the first element that is not less than
     // (i.e. greater or equal to) key
-#ifdef INSTRUMENT_DEPTH
-    inline static std::size_t down = 0;
-    inline static std::size_t called = 0;
-#endif
     [[nodiscard]] iterator lower_bound(const Key &key) {
-#ifdef INSTRUMENT_DEPTH
-        called++;
-#endif
+        if constexpr (branchless_keys<Key, Compare>) {
+            node *n = root();
+            node *res = &header;
+            while (n != nullptr) {
+                const bool go_right = less(n->key(), key);
+                node *const children[2] = {n->left, n->right};
+                res = go_right ? res : n;
+                n = children[go_right];
+                tally(&tree_stats::nodes_visited);
+            }
+            return iterator{res};
+        }
+        const std::uint64_t prefix = prefix_of(key);
         iterator rt{root()};
         iterator res = end();
         while (rt.node != nullptr) {
             assert(rt.node != rt.node->left);
             assert(rt.node != rt.node->right);
-            if (!Compare()(rt.node->key(), key)) { // Basically key <= rt.node->key()
+            if (!node_less(rt.node, key, prefix)) { // Basically key <= rt.node->key()
                 res = rt;
                 rt.node = rt.node->left;
             } else {
                 rt.node = rt.node->right;
             }
-#ifdef INSTRUMENT_DEPTH
-            down++;
-#endif
+            tally(&tree_stats::nodes_visited);
         }
         return res;
     }
 
     // Returns an iterator pointing to the first element that is greater than key
     [[nodiscard]] iterator upper_bound(const Key &key) {
+        if constexpr (branchless_keys<Key, Compare>) {
+            node *n = root();
+            node *res = &header;
+            while (n != nullptr) {
+                const bool go_left = less(key, n->key());
+                node *const children[2] = {n->right, n->left};
+                res = go_left ? n : res;
+                n = children[go_left];
+                tally(&tree_stats::nodes_visited);
+            }
+            return iterator{res};
+        }
+        const std::uint64_t prefix = prefix_of(key);
         iterator rt{root()};
         iterator res = end();
         while (rt.node != nullptr) {
             assert(rt.node != rt.node->left);
             assert(rt.node != rt.node->right);
-            if (Compare()(key, rt.node->key())) {
+            if (less_node(key, prefix, rt.node)) {
                 res = rt;
                 rt.node = rt.node->left;
             } else {
                 rt.node = rt.node->right;
             }
+            tally(&tree_stats::nodes_visited);
         }
         return res;
     }
@@ -150,13 +743,12 @@ public:
     // Insertion fails when an element with the same key already exists
     // In that case, the returned iterator points to that element
     std::pair<iterator, bool> insert(const value_type &value) {
-        const Key &key = key_of(value);
-        iterator it = lower_bound(key);
+        const auto [it, found] = locate(key_of(value));
         // Return if element already exists
-        if (it != end() && key_of(*it) == key) {
+        if (found) {
             return {it, false};
         }
-        return {insert_(it, value), true};
+        return {derived().insert_(it, value), true};
     }
 
     // Inserts value in the position as close as possible to the position
@@ -165,22 +757,22 @@ public:
     // that prevented the insertion
     iterator insert(const_iterator pos, const value_type &value) {
         const Key &key = key_of(value);
-        // Replace hint with default (lower_bound) if it is bad
+        // Look the key up as usual if the hint is bad
         // i.e. !(key < iterator's key) or !(prev(iterator)'s key < key)
-        if (!Compare()(key, key_of(*pos)) || !(pos == begin() || Compare()(key_of(*std::prev(pos)), key))) {
-            pos = lower_bound(key);
-        }
-        // Return if element already exists
-        if (pos != end() && key_of(*pos) == key) {
-            return iterator{pos.node};
+        if ((pos != end() && !less(key, pos.node->key())) || !(pos == begin() || less(std::prev(pos).node->key(), key))) {
+            const auto [it, found] = locate(key);
+            if (found) {
+                return it;
+            }
+            pos = it;
         }
-        return insert_(pos, value);
+        return derived().insert_(pos, value);
     }
 
     // Removes the element at pos
     // Returns the iterator following the last removed element
     iterator erase(iterator pos) {
-        return erase_(pos);
+        return derived().erase_(pos);
     }
 
     // Returns the number of elements removed (0 or 1)
@@ -190,10 +782,269 @@ public:
         if (it == end()) {
             return 0;
         }
-        std::ignore = erase_(it);
+        std::ignore = derived().erase_(it);
         return 1;
     }
 
+    // Removes the elements in [first, last)
+    // Returns the iterator following the last removed element
+    iterator erase(const_iterator first, const_iterator last) {
+        while (first != last) {
+            first = derived().erase_(first);
+        }
+        return last;
+    }
+
+    // Removes the elements with keys in [lo, hi) and returns how many there were
+    size_type erase_range(const Key &lo, const Key &hi) {
+        if (!less(lo, hi)) {
+            return 0;
+        }
+        const size_type old_size = size();
+        derived().erase(lower_bound(lo), lower_bound(hi));
+        return old_size - size();
+    }
+
+    // Removes every element. O(n)
+    void clear() noexcept {
+        if constexpr (filter_base::filtered) {
+            this->filter_.clear();
+        }
+        if constexpr (index_base::indexed) {
+            this->index_.clear();
+        }
+        if (header.par != nullptr) {
+            destroy_tree();
+        }
+        release(allocator, std::exchange(arena_, nullptr));
+        reset_header();
+        derived().reset_balance();
+        assert(size() == 0);
+    }
+
+    // Removes every element in O(1) and leaves freeing them to a task on pool,
+    // so that dropping a large tree doesn't stall the calling thread
+    // The allocator is copied into the task and used from its thread, so it
+    // has to be safe to use from several threads at once (std::allocator is)
+    // Without any workers in pool, this is just clear()
+    // To drop a tree without waiting, call this before it is destroyed
+    void clear_async(thread_pool &pool = thread_pool::shared()) {
+        if (pool.size() == 0) {
+            clear();
+            return;
+        }
+        if constexpr (filter_base::filtered) {
+            this->filter_.clear();
+        }
+        if constexpr (index_base::indexed) {
+            this->index_.clear();
+        }
+        derived().reset_balance();
+        node *const root = std::exchange(header.par, nullptr);
+        arena *const nodes = std::exchange(arena_, nullptr);
+        if (root == nullptr) {
+            release(allocator, nodes);
+            return;
+        }
+        tally(&tree_stats::deallocations, size_);
+        size_ = 0;
+        reset_header();
+        try {
+            pool.push([alloc = allocator, root, nodes]() mutable {
+                free_subtree(alloc, root, nodes);
+                release(alloc, nodes);
+            });
+        } catch (...) {
+            free_subtree(allocator, root, nodes);
+            release(allocator, nodes);
+        }
+    }
+
+    // Moves every element into a single block of nodes, laid out in
+    // pre-order, so that a lookup's next node is often right after the one
+    // it is at and the nodes of a subtree sit together, however scattered
+    // over the heap churn has left them. The shape of the tree, and with it
+    // every balancing field, stays as it is. O(n)
+    // Elements are moved when that can't throw, and copied otherwise, in which
+    // case the tree is left as it was if a copy throws
+    // The tree stays fully usable: new elements are allocated one by one as
+    // usual, and the slots of erased ones aren't given back on their own.
+    // The whole block is, by the next compact(), or once the tree is empty and
+    // no tree that extract_range() handed some of the block to holds it
+    // Iterators and references are invalidated
+    void compact() {
+        if (header.par == nullptr) {
+            release(allocator, std::exchange(arena_, nullptr));
+            return;
+        }
+        arena *const fresh = make_arena(size());
+        node *const dst = fresh->nodes;
+        size_type built = 0;
+        // Each node to copy, with the copy of its parent and the side it goes on
+        struct pending {
+            node *src;
+            node *par;
+            bool left;
+        };
+        std::vector<pending> stack{{header.par, nullptr, false}};
+        try {
+            while (!stack.empty()) {
+                const pending next = stack.back();
+                stack.pop_back();
+                node *const n = dst + built;
+                std::allocator_traits<node_allocator>::construct(allocator, n, std::move_if_noexcept(*next.src));
+                built++;
+                n->left = nullptr;
+                n->right = nullptr;
+                n->par = next.par;
+                if (next.par != nullptr) {
+                    (next.left ? next.par->left : next.par->right) = n;
+                }
+                // Left on top, so that it comes right after n
+                if (next.src->right != nullptr) {
+                    stack.push_back({next.src->right, n, false});
+                }
+                if (next.src->left != nullptr) {
+                    stack.push_back({next.src->left, n, true});
+                }
+            }
+        } catch (...) {
+            for (size_type i = 0; i < built; i++) {
+                std::allocator_traits<node_allocator>::destroy(allocator, dst + i);
+            }
+            release(allocator, fresh);
+            throw;
+        }
+        assert(built == size());
+        tally(&tree_stats::allocations);
+        tally(&tree_stats::deallocations, free_subtree(allocator, header.par, arena_));
+        release(allocator, std::exchange(arena_, fresh));
+        header.par = dst;
+        dst->par = &header;
+        header.left = leftmost_of(dst);
+        header.right = rightmost_of(dst);
+        // Same number of nodes, so no room has to be made
+        if constexpr (index_base::indexed) {
+            this->index_.reset();
+            for (size_type i = 0; i < built; i++) {
+                this->index_.insert(dst + i);
+            }
+        }
+    }
+
+    // Returns the number of elements with key (0 or 1)
+    [[nodiscard]] size_type count(const Key &key) {
+        return find(key) != end();
+    }
+
+    // Whether there is an element with key
+    [[nodiscard]] bool contains(const Key &key) {
+        return find(key) != end();
+    }
+
+    // Returns the range of elements with key, as [lower_bound(key), upper_bound(key))
+    [[nodiscard]] std::pair<iterator, iterator> equal_range(const Key &key) {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    // Calls f(element) for every element with a key in [lo, hi), in key order
+    // One descent finds lo and an explicit stack of the nodes still to visit
+    // does the rest, instead of climbing back up through par after every
+    // right subtree like iterators do. The right child of every node on the
+    // stack is prefetched as it is pushed, well before it is needed
+    // f must not insert or erase elements
+    template<class F>
+    void for_each_in_range(const Key &lo, const Key &hi, F f) {
+        std::vector<node *> stack;
+        stack.reserve(64);
+        const std::uint64_t lo_prefix = prefix_of(lo);
+        for (node *n = header.par; n != nullptr; ) {
+            tally(&tree_stats::nodes_visited);
+            if (!node_less(n, lo, lo_prefix)) {
+                prefetch(n->right);
+                stack.push_back(n);
+                n = n->left;
+            } else {
+                n = n->right;
+            }
+        }
+        const std::uint64_t hi_prefix = prefix_of(hi);
+        while (!stack.empty()) {
+            node *const n = stack.back();
+            stack.pop_back();
+            if (!node_less(n, hi, hi_prefix)) {
+                return;
+            }
+            f(n->record);
+            for (node *c = n->right; c != nullptr; c = c->left) {
+                prefetch(c->right);
+                stack.push_back(c);
+            }
+        }
+    }
+
+    // Copies every element with a key in [lo, hi) to out, in key order
+    // Returns the output iterator past the last element copied
+    template<class OutputIt>
+    OutputIt copy_range(const Key &lo, const Key &hi, OutputIt out) {
+        for_each_in_range(lo, hi, [&out](const value_type &value) {
+            *out = value;
+            ++out;
+        });
+        return out;
+    }
+
+    // Parallel algorithms
+    // The tree is cut at subtree roots into pieces of about grain elements,
+    // which run as tasks on pool. A subtree's size is estimated from its depth
+    // (size() / 2^depth), which is close enough for every tree here
+    // None of them may insert or erase elements while they run
+
+    // Calls f(element) for every element, in no particular order and from
+    // several threads at once
+    template<class F>
+    void parallel_for_each(F f, size_type grain = DEFAULT_GRAIN, thread_pool &pool = thread_pool::shared()) {
+        if (header.par != nullptr) {
+            for_each_subtree(header.par, size(), std::max<size_type>(grain, 1), f, pool);
+        }
+    }
+
+    // Returns reduce(...reduce(reduce(init, transform(e1)), transform(e2))...)
+    // over the elements e1, e2... in key order, but grouped arbitrarily, so
+    // reduce has to be associative (but not commutative)
+    template<class R, class Reduce, class Transform>
+    [[nodiscard]] R parallel_reduce(R init, Reduce reduce, Transform transform, size_type grain = DEFAULT_GRAIN,
+                                    thread_pool &pool = thread_pool::shared()) {
+        if (header.par == nullptr) {
+            return init;
+        }
+        R res = reduce_subtree<R>(header.par, size(), std::max<size_type>(grain, 1), reduce, transform, pool);
+        return reduce(std::move(init), std::move(res));
+    }
+
+    // Inserts the elements of [first, last) as insert() would one by one: of
+    // several elements with equivalent keys the first wins, and none replaces
+    // an element already in the tree. Returns the number inserted
+    // The batch is sorted on pool and deduplicated first, so that it goes in
+    // in key order. Treaps go further and union it in as a whole
+    template<class InputIt>
+    size_type insert_bulk(InputIt first, InputIt last, size_type grain = DEFAULT_GRAIN,
+                          thread_pool &pool = thread_pool::shared()) {
+        const size_type old_size = size();
+        for (auto &value : sorted_batch(first, last, grain, pool)) {
+            derived().insert(value_type(std::move(value)));
+        }
+        return size() - old_size;
+    }
+
+    // Sets the mapped value of every element to f(element)
+    template<class F, class U = T, std::enable_if_t<!is_null_type<U>, bool> = true>
+    void parallel_transform(F f, size_type grain = DEFAULT_GRAIN, thread_pool &pool = thread_pool::shared()) {
+        parallel_for_each([&f](value_type &value) {
+            value.second = f(std::as_const(value));
+        }, grain, pool);
+    }
+
     [[nodiscard]] iterator begin() noexcept {
         return iterator{n_begin()};
     }
@@ -214,42 +1065,105 @@ public:
         return size_;
     }
 
+    // All zeros unless BST_STATS is on
+    [[nodiscard]] tree_stats stats() const noexcept {
+        if constexpr (stats_holder<>::enabled) {
+            return this->stats_;
+        } else {
+            return {};
+        }
+    }
+
+    void reset_stats() noexcept {
+        if constexpr (stats_holder<>::enabled) {
+            this->stats_ = {};
+        }
+    }
+
+    // Walks the whole tree, O(n)
+    [[nodiscard]] tree_shape shape() const {
+        tree_shape res;
+        res.size = size();
+        if (header.par == nullptr) {
+            return res;
+        }
+        std::size_t depth_sum = 0;
+        std::vector<std::pair<const node *, std::size_t>> stack{{header.par, 0}};
+        while (!stack.empty()) {
+            const auto [n, depth] = stack.back();
+            stack.pop_back();
+            if (res.depth_histogram.size() <= depth) {
+                res.depth_histogram.resize(depth + 1);
+            }
+            res.depth_histogram[depth]++;
+            depth_sum += depth;
+            if (n->left != nullptr) {
+                stack.emplace_back(n->left, depth + 1);
+            }
+            if (n->right != nullptr) {
+                stack.emplace_back(n->right, depth + 1);
+            }
+        }
+        res.height = res.depth_histogram.size();
+        res.average_path = static_cast<double>(depth_sum + res.size) / static_cast<double>(res.size);
+        return res;
+    }
+
     // Don't use size() == 0 as after create_node it will be inaccurate
     [[nodiscard]] bool empty() const noexcept {
         return begin() == end();
     }
 
-    template<typename U = T>
-    typename std::enable_if_t<!is_null_type<U>, U&> operator[](const Key &key) {
-        if (auto it = find(key) ; it != end()) {
-            return it->second;
+    // Bytes taken up by the container and its nodes
+    // Memory owned by the elements themselves (e.g. string buffers) and the
+    // allocator's own bookkeeping are not included, nor are the slots of
+    // erased elements in a block laid out by compact()
+    [[nodiscard]] size_type memory_usage() const noexcept {
+        size_type res = sizeof(Derived) + size() * sizeof(node);
+        if constexpr (filter_base::filtered) {
+            res += this->filter_.memory_usage();
         }
-        const value_type new_val(std::piecewise_construct, std::forward_as_tuple(key), std::tuple<>());
+        if constexpr (index_base::indexed) {
+            res += this->index_.memory_usage();
+        }
+        return res;
+    }
+
+    template<typename U = T>
+    typename std::enable_if_t<!is_null_type<U>, U&> operator[](const Key &key) {
+        if (auto it = derived().find(key) ; it != end()) {
+            return it->second;
+        }
+        const value_type new_val(std::piecewise_construct, std::forward_as_tuple(key), std::tuple<>());
         auto [it, ok] = insert(new_val);
         assert(ok);
         return it->second;
     }
 
+    [[nodiscard]] key_compare key_comp() const {
+        return this->comparator();
+    }
+
     [[nodiscard]] allocator_type get_allocator() const noexcept {
         return {allocator};
     }
 
-private:
-    // Just remember that incrementing treap_iter does an in-order traversal
+protected:
+    // Just remember that incrementing tree_iter does an in-order traversal
     template<class U>
-    struct treap_iter {
+    struct tree_iter {
     public:
         template<class V>
-        treap_iter(const treap_iter<V> &rhs) : treap_iter(rhs.node) {} // NOLINT(google-explicit-constructor)
+        tree_iter(const tree_iter<V> &rhs) : tree_iter(rhs.node) {} // NOLINT(google-explicit-constructor)
 
-        constexpr bool operator==(const treap_iter &rhs) const {
+        constexpr bool operator==(const tree_iter &rhs) const {
             return node == rhs.node;
         }
 
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "Simplify"
 
-        constexpr bool operator!=(const treap_iter &rhs) const {
+        constexpr bool operator!=(const tree_iter &rhs) const {
             return !(*this == rhs);
         }
 
@@ -261,10 +1175,10 @@ private:
         struct value_type_of {};
 
         template<class V>
-        struct value_type_of<V, std::enable_if_t<!std::is_const_v<V>>> { using type = treap::value_type; };
+        struct value_type_of<V, std::enable_if_t<!std::is_const_v<V>>> { using type = bst_base::value_type; };
 
         template<class V>
-        struct value_type_of<V, std::enable_if_t<std::is_const_v<V>>> { using type = const treap::value_type; };
+        struct value_type_of<V, std::enable_if_t<std::is_const_v<V>>> { using type = const bst_base::value_type; };
 
     public:
         // LegacyIterator requirements
@@ -291,7 +1205,7 @@ private:
         // ++it
         // Find node with the smallest key greater than current
         // Assume it != end()
-        treap_iter &operator++() {
+        tree_iter &operator++() {
             // Case 1: Has no right child -> Largest in left subtree; go up to parent of this subtree
             if (node->right == nullptr) {
                 while (node->par->right == node) {
@@ -324,8 +1238,8 @@ private:
         // LegacyForwardIterator requirements
 
         // it++
-        treap_iter operator++(int) { // NOLINT(cert-dcl21-cpp)
-            treap_iter tmp = *this;
+        tree_iter operator++(int) { // NOLINT(cert-dcl21-cpp)
+            tree_iter tmp = *this;
             ++*this;
             return tmp;
         }
@@ -335,7 +1249,7 @@ private:
         // --it
         // Find node with the largest key smaller than current
         // Assume it != begin()
-        treap_iter &operator--() {
+        tree_iter &operator--() {
             // Case 1: Has no left child -> Smallest in right subtree; go up to parent of this subtree
             if (node->left == nullptr) {
                 while (node->par->left == node) {
@@ -360,52 +1274,25 @@ private:
         }
 
         // it--
-        treap_iter operator--(int) { // NOLINT(cert-dcl21-cpp)
-            treap_iter tmp = *this;
+        tree_iter operator--(int) { // NOLINT(cert-dcl21-cpp)
+            tree_iter tmp = *this;
             --*this;
             return tmp;
         }
 
     private:
-        friend class treap;
+        friend class bst_base;
+        friend Derived;
 
-        treap_iter() = default;
+        tree_iter() = default;
 
-        explicit treap_iter(U *_node) : node(const_cast<std::remove_const_t<U> *>(_node)) {}
+        explicit tree_iter(U *_node) : node(const_cast<std::remove_const_t<U> *>(_node)) {}
 
         std::remove_const_t<U> *node{};
     };
 
     using node_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<node>;
 
-    struct node {
-        using priority = std::uint32_t;
-
-        explicit node(const value_type &value, node *_par)
-                : record(value),
-                  pri(treap::generator()),
-                  par(_par) {
-            assert(this != par);
-        }
-
-        template<class U = T, std::enable_if_t<!is_null_type<U>, bool> = true>
-        [[nodiscard]] const Key &key() const {
-            return record.first;
-        }
-
-        template<class U = T, std::enable_if_t<is_null_type<U>, bool> = true>
-        [[nodiscard]] const Key &key() const {
-            return record;
-        }
-
-        value_type record{};
-        node       *left{};
-        node       *right{};
-        node       *par{};
-        priority   pri{};
-    };
-    static_assert(sizeof(node) == 40);
-
     [[nodiscard]] node *&root() {
         if (header.par && header.par->par != &header) {
             assert(false);
@@ -438,33 +1325,6 @@ private:
         return const_iterator{n_rightmost()};
     }
 
-    // Auxiliary operation: Time complexity O(log n)
-    // Requires all keys in lhs <= all keys in rhs
-    // If we call split() and get (ll, rr), calling
-    // merge(ll, rr) is guaranteed to meet this condition
-    [[nodiscard]] node *merge(node *lhs, node *rhs) {
-        if (lhs == nullptr || rhs == nullptr) {
-            return lhs != nullptr ? lhs : rhs;
-        }
-        assert(lhs->left == nullptr || lhs->left->par == lhs);
-        assert(lhs->right == nullptr || lhs->right->par == lhs);
-        assert(rhs->left == nullptr || rhs->left->par == rhs);
-        assert(rhs->right == nullptr || rhs->right->par == rhs);
-        // lhs has to be subtree of rhs
-        // Merge lhs and rhs->left to form new rhs->left
-        // Return new root rhs
-        // Don't use Compare because we always use our own priorities and < operator
-        if (lhs->pri < rhs->pri) {
-            assign_and_keep(rhs->left, merge(lhs, rhs->left), rhs);
-            return rhs;
-        }
-        // rhs has to be subtree of lhs
-        // Merge lhs->right and rhs to form new lhs->right
-        // Return new root lhs
-        assign_and_keep(lhs->right, merge(lhs->right, rhs), lhs);
-        return lhs;
-    }
-
     template<class U = T>
     [[nodiscard]] std::enable_if_t<!is_null_type<U>, const Key &> key_of(const value_type &value) {
         return value.first;
@@ -476,7 +1336,9 @@ private:
     }
 
     // Helper tree rotation functions
-    void rotate_right(node *&par, node *&child) {
+    // child takes the place of par, which becomes child's right child
+    void rotate_right(node *par, node *child) {
+        tally(&tree_stats::rotations);
         assert(par != &header);
         assert(child != &header);
         assert(par->left == child);
@@ -501,7 +1363,9 @@ private:
         }
     }
 
-    void rotate_left(node *&par, node *&child) {
+    // child takes the place of par, which becomes child's left child
+    void rotate_left(node *par, node *child) {
+        tally(&tree_stats::rotations);
         assert(par != &header);
         assert(child != &header);
         assert(par->right == child);
@@ -525,168 +1389,337 @@ private:
         }
     }
 
-    // Assumes that pos really points to the position right after where value is to be inserted
-    // TODO: See if we can just do the 1st method: Split at correct position & call merge()
-    //  Use that if the performance is the same. That way we can eliminate the tree rotation code.
-    [[nodiscard]] iterator insert_(const_iterator pos, const value_type &value) {
-        const Key &key = key_of(value);
-
-        // Make new node from value_type
-        node *node_ = create_node(value, nullptr);
-
-        iterator it{node_};
-
+    // Hangs the new leaf n next to pos, which has to be the element right after
+    // n in key order, and keeps begin() and rightmost() up to date
+    // Rebalancing is left to the caller
+    void link_leaf(const_iterator pos, node *n) {
         // par == end() corner cases
         if (empty()) {
-            it.node->par = &header;
-            n_begin() = it.node;
-            n_rightmost() = it.node;
-            root() = it.node;
-            return it;
+            n->par = &header;
+            n_begin() = n;
+            n_rightmost() = n;
+            root() = n;
+            return;
         }
 
         // Add to a correct place based on key
-        iterator par;
         if (pos.node->left == nullptr) { // Includes begin()
             assert(pos != end());
-            par = pos;
-            assert(Compare()(key, key_of(*par)));
+            assert(!uncounted_less(pos.node->key(), n->key()));
             // Update left node of leaf
-            par.node->left = it.node;
+            pos.node->left = n;
+            n->par = pos.node;
+            if (pos == begin()) {
+                n_begin() = n;
+            }
         } else { // Includes end()
             assert(pos != begin());
-            par = std::prev(pos);
-            assert(par.node->right == nullptr);
-            if (!Compare()(key_of(*par), key))
-                assert(false);
-            assert(Compare()(key_of(*par), key));
+            node *par = std::prev(pos).node;
+            assert(par->right == nullptr);
+            assert(!uncounted_less(n->key(), par->key()));
             // Update right node of leaf
-            par.node->right = it.node;
+            par->right = n;
+            n->par = par;
+            if (pos == end()) {
+                n_rightmost() = n;
+            }
         }
-        it.node->par = par.node;
-        assert(par != end());
+    }
 
-        // Strict inequality so we won't rotate out header
-        while (par.node->pri < it.node->pri) {
-            assert(par.node != &header); // Rotates will mess up
-            if (par.node->left == it.node) {
-                rotate_right(par.node, it.node);
-            } else {
-                assert(par.node->right == it.node);
-                rotate_left(par.node, it.node);
-            }
-            par.node = it.node->par;
+    // Updates begin() and rightmost() before pos is unlinked
+    // next_it has to be std::next(pos)
+    // If size_ is going from 1 to 0, next_it is automatically end()
+    void unlink_bounds(const_iterator pos, const_iterator next_it) {
+        if (pos == begin()) {
+            n_begin() = next_it.node;
+        } else if (next_it == end()) {
+            n_rightmost() = std::prev(pos).node;
         }
+    }
 
-        // Update begin() and rightmost()
-        assert(!empty());
-        if (Compare()(key_of(*it), key_of(*begin()))) {
-            n_begin() = it.node; // TODO: Force compiler errors when doing begin() = it.node
+    // Puts subtree v in the place of subtree u, fixing the link from u's parent
+    // Neither u's children nor v's old parent are touched
+    void transplant(node *u, node *v) {
+        node *const par = u->par;
+        if (par == &header) {
+            header.par = v;
+        } else if (par->left == u) {
+            par->left = v;
+        } else {
+            assert(par->right == u);
+            par->right = v;
         }
-        if (Compare()(key_of(*rightmost()), key_of(*it))) {
-            n_rightmost() = it.node;
+        if (v != nullptr) {
+            v->par = par;
         }
+    }
 
-        return it;
+    // Takes z out of the tree without rebalancing
+    // When z has two children its successor succ is moved into its place,
+    // so that no other node moves and iterators to them stay valid
+    // z's own links are left untouched for the caller to inspect
+    // Returns the lowest node whose subtree lost a node, which may be &header
+    node *unlink(node *z, node *succ) {
+        if (z->left == nullptr || z->right == nullptr) {
+            node *const par = z->par;
+            transplant(z, z->left != nullptr ? z->left : z->right);
+            return par;
+        }
+        assert(succ->left == nullptr);
+        node *lowest = succ;
+        if (succ->par != z) {
+            lowest = succ->par;
+            transplant(succ, succ->right);
+            succ->right = z->right;
+            succ->right->par = succ;
+        }
+        transplant(z, succ);
+        succ->left = z->left;
+        succ->left->par = succ;
+        return lowest;
     }
 
-    // Merge left and right of pos's node and replace pos's node with the result
-    [[nodiscard]] iterator erase_(iterator pos) {
-        assert(pos != end());
-        iterator next_it = std::next(pos); // Gets iterator to element with next biggest key
+    // Copies the subtree at src into dst, linking each node in as soon as it is
+    // made, so that everything copied so far is freed with dst if an allocation throws
+    // Goes through the subtree with an explicit stack of the links still to
+    // fill, as a degenerate tree would otherwise recurse once per level
+    void clone_into(node *&dst, const node *src, node *par) {
+        // Each link still to fill, the node to copy into it and its parent
+        struct pending {
+            node **dst;
+            const node *src;
+            node *par;
+        };
+        std::vector<pending> stack{{&dst, src, par}};
+        while (!stack.empty()) {
+            const pending next = stack.back();
+            stack.pop_back();
+            node *const n = create_node(*next.src);
+            *next.dst = n;
+            n->par = next.par;
+            n->left = nullptr;
+            n->right = nullptr;
+            if (next.src->right != nullptr) {
+                stack.push_back({&n->right, next.src->right, n});
+            }
+            if (next.src->left != nullptr) {
+                stack.push_back({&n->left, next.src->left, n});
+            }
+        }
+    }
 
-        // Update begin() and rightmost()
-        // If size_ is going from 1 to 0, next_it is automatically end()
-        if (pos == begin()) {
-            n_begin() = next_it.node;
-        } else if (next_it == end()) {
-            n_rightmost() = std::prev(pos).node;
+    [[nodiscard]] static node *leftmost_of(node *n) {
+        while (n->left != nullptr) {
+            n = n->left;
         }
+        return n;
+    }
 
-        assign_and_destroy(pos.node, merge(pos.node->left, pos.node->right), pos.node->par);
+    [[nodiscard]] static node *rightmost_of(node *n) {
+        while (n->right != nullptr) {
+            n = n->right;
+        }
+        return n;
+    }
 
-        return next_it;
+    // Empties the header, without touching any node
+    void reset_header() {
+        header.left = &header;
+        header.right = &header;
+        header.par = nullptr;
     }
 
-    // Replaces dst with src, taking care of dangling pointers
-    // Does not delete the node pointed to by dst
-    // Pass par if dst may be nullptr
-    void assign_and_keep(node *&dst, node *src, node *par) {
-        assert(dst != &header);
-        assert(dst != par);
-        assert(src != par);
-        assert(par != nullptr);
-        if (par == &header) {
-            if (header.par != dst) {
-                assert(false);
-            }
-            assert(header.par == dst);
+    // Points the root back at the header after the links were moved here
+    // from another tree, or resets the header if there is no root
+    void fix_header() {
+        if (header.par != nullptr) {
+            header.par->par = &header;
         } else {
-            assert(par->left == dst || par->right == dst);
+            reset_header();
         }
+    }
 
-        // Should not be the root node!
-        if (dst == nullptr) {
-            dst = src;
-            assert(par != nullptr);
-            if (dst != nullptr) {
-                dst->par = par;
-            }
-            return;
+    // Swaps everything but the derived trees' balancing state, which isn't
+    // there yet in the move constructor and isn't there at all in the
+    // temporaries of the assignments (the derived ones assign it themselves)
+    void swap_contents(bst_base &other) noexcept {
+        std::swap(header.par, other.header.par);
+        std::swap(header.left, other.header.left);
+        std::swap(header.right, other.header.right);
+        std::swap(size_, other.size_);
+        std::swap(allocator, other.allocator);
+        std::swap(arena_, other.arena_);
+        std::swap(static_cast<compare_holder<Compare> &>(*this), static_cast<compare_holder<Compare> &>(other));
+        std::swap(static_cast<filter_base &>(*this), static_cast<filter_base &>(other));
+        std::swap(static_cast<index_base &>(*this), static_cast<index_base &>(other));
+        fix_header();
+        other.fix_header();
+    }
+
+    // Hooks for the balancing state a derived tree keeps outside its nodes,
+    // which swap() swaps and clear() resets. Hidden by the trees that have any
+    void swap_balance(Derived &) noexcept {}
+
+    void reset_balance() noexcept {}
+
+    static constexpr size_type DEFAULT_GRAIN = 4096;
+
+    // Elements of a batch being inserted, which unlike value_type can be
+    // moved around by a sort
+    using staged_value = std::conditional_t<is_null_type<T>, Key, std::pair<Key, T>>;
+
+    [[nodiscard]] static const Key &staged_key(const staged_value &value) {
+        if constexpr (is_null_type<T>) {
+            return value;
+        } else {
+            return value.first;
         }
+    }
 
-        // Special root node treatment
-        if (par == &header) {
-            dst = src;
-            if (dst != nullptr) {
-                dst->par = &header;
+    // Copies [first, last), sorts it on pool and, if unique, keeps the first
+    // of each run of equivalent keys. The sort is stable either way
+    // Comparisons aren't counted, as the sort runs on several threads
+    template<class InputIt>
+    [[nodiscard]] std::vector<staged_value> sorted_batch(InputIt first, InputIt last, size_type grain,
+                                                         thread_pool &pool, bool unique = true) const {
+        std::vector<staged_value> res(first, last);
+        const auto key_less = [this](const staged_value &lhs, const staged_value &rhs) {
+            return uncounted_less(staged_key(lhs), staged_key(rhs));
+        };
+        impl::parallel_stable_sort(res.begin(), res.end(), key_less, std::max<size_type>(grain, 1), pool);
+        if (!unique) {
+            return res;
+        }
+        res.erase(std::unique(res.begin(), res.end(), [&key_less](const staged_value &kept, const staged_value &next) {
+            return !key_less(kept, next);
+        }), res.end());
+        return res;
+    }
+
+    // Calls f on every element of the subtree at n, without recursion
+    template<class F>
+    static void walk_subtree(node *n, F &f) {
+        std::vector<node *> stack;
+        for (;;) {
+            for (; n != nullptr; n = n->left) {
+                prefetch(n->right);
+                stack.push_back(n);
             }
-            header.par = dst;
+            if (stack.empty()) {
+                return;
+            }
+            n = stack.back();
+            stack.pop_back();
+            f(n->record);
+            n = n->right;
+        }
+    }
+
+    // Hands the left subtree of n to another thread and does n and its right
+    // subtree itself, until the subtrees are down to grain elements
+    template<class F>
+    static void for_each_subtree(node *n, size_type estimate, size_type grain, F &f, thread_pool &pool) {
+        if (estimate <= grain) {
+            walk_subtree(n, f);
             return;
         }
+        impl::task_group group(pool);
+        if (n->left != nullptr) {
+            group.spawn([=, &f, &pool] { for_each_subtree(n->left, estimate / 2, grain, f, pool); });
+        }
+        f(n->record);
+        if (n->right != nullptr) {
+            for_each_subtree(n->right, estimate / 2, grain, f, pool);
+        }
+        group.wait();
+    }
 
-        // Backup
-        const bool is_left_child = par->left == dst;
+    // The reduction of the subtree at n, which mustn't be empty
+    template<class R, class Reduce, class Transform>
+    static R reduce_subtree(node *n, size_type estimate, size_type grain, Reduce &reduce, Transform &transform,
+                            thread_pool &pool) {
+        std::optional<R> res;
+        const auto add = [&](value_type &value) {
+            res = res ? reduce(std::move(*res), transform(std::as_const(value))) : R(transform(std::as_const(value)));
+        };
+        if (estimate <= grain) {
+            walk_subtree(n, add);
+            return std::move(*res);
+        }
+        std::optional<R> left;
+        impl::task_group group(pool);
+        if (n->left != nullptr) {
+            group.spawn([=, &left, &reduce, &transform, &pool] {
+                left = reduce_subtree<R>(n->left, estimate / 2, grain, reduce, transform, pool);
+            });
+        }
+        add(n->record);
+        if (n->right != nullptr) {
+            res = reduce(std::move(*res), reduce_subtree<R>(n->right, estimate / 2, grain, reduce, transform, pool));
+        }
+        group.wait();
+        return left ? reduce(std::move(*left), std::move(*res)) : std::move(*res);
+    }
 
-        // Assign
-        dst = src;
+    // Frees a node that has already been unlinked from the tree
+    void destroy_unlinked(node *n) {
+        n->left = nullptr;
+        n->right = nullptr;
+        destroy_node(n);
+        // Special empty treatment
+        if (size() == 0) {
+            reset_header();
+        }
+    }
 
-        // Fix par's child
-        is_left_child ? par->left = dst : par->right = dst;
+    // A block of nodes laid out by compact(), shared by every tree that
+    // still has nodes in it (extract_range() can hand some of them over)
+    // Freed along with the last tree to let go of it
+    struct arena {
+        arena(node *nodes, size_type capacity) : nodes(nodes), capacity(capacity) {}
 
-        // Fix new dst's par
-        // May be nullptr if src is nullptr; in that case, only par's child is updated
-        if (dst != nullptr) {
-            dst->par = par;
+        node *nodes;
+        size_type capacity;
+        std::atomic<size_type> refs{1};
+
+        [[nodiscard]] bool owns(const node *n) const noexcept {
+            return !std::less<const node *>()(n, nodes) && std::less<const node *>()(n, nodes + capacity);
         }
+    };
 
-        assert(dst == nullptr || dst->par == par);
-        assert(par->left == dst || par->right == dst);
+    using arena_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<arena>;
+
+    [[nodiscard]] arena *make_arena(size_type capacity) {
+        arena_allocator alloc(allocator);
+        arena *const res = std::allocator_traits<arena_allocator>::allocate(alloc, 1);
+        try {
+            node *const nodes = std::allocator_traits<node_allocator>::allocate(allocator, capacity);
+            std::allocator_traits<arena_allocator>::construct(alloc, res, nodes, capacity);
+        } catch (...) {
+            std::allocator_traits<arena_allocator>::deallocate(alloc, res, 1);
+            throw;
+        }
+        return res;
     }
 
-    // Replaces dst with src, taking care of dangling pointers
-    // Also destroys the node pointed to by dst
-    // Requires that dst points to a valid node
-    void assign_and_destroy(node *&dst, node *src, node *par) {
-        assert(dst != &header);
-        assert(dst != nullptr);
-        assert(par != nullptr);
-        // Backup
-        node *const dst_old = dst;
-        assign_and_keep(dst, src, par);
-        // Prevent transferred children from being destroyed
-        dst_old->left = nullptr;
-        dst_old->right = nullptr;
-        // Destroy old dst
-        destroy_node(dst_old);
-        // Special empty treatment
-        // Have to use this condition as begin() is invalidated
-        // in the line ??? // TODO update
-        if (size() == 0) {
-            header.left = &header;
-            header.right = &header;
-            header.par = nullptr;
+    // Shares a's block with another tree
+    [[nodiscard]] static arena *share(arena *a) noexcept {
+        if (a != nullptr) {
+            a->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        return a;
+    }
+
+    // Lets go of a's block, which has to have none of the tree's nodes left
+    // in it, and frees it if no other tree holds it
+    static void release(node_allocator &alloc, arena *a) noexcept {
+        if (a == nullptr || a->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
         }
+        std::allocator_traits<node_allocator>::deallocate(alloc, a->nodes, a->capacity);
+        arena_allocator arena_alloc(alloc);
+        std::allocator_traits<arena_allocator>::destroy(arena_alloc, a);
+        std::allocator_traits<arena_allocator>::deallocate(arena_alloc, a, 1);
     }
 
     node_allocator &get_node_allocator() {
@@ -695,68 +1728,2308 @@ private:
 
     template<class... Args>
     node *create_node(Args &&...args) {
+        if constexpr (index_base::indexed) {
+            this->index_.reserve(this->index_.size() + 1);
+        }
         node *res = std::allocator_traits<node_allocator>::allocate(get_node_allocator(), 1);
         std::allocator_traits<node_allocator>::construct(get_node_allocator(), res, std::forward<Args>(args)...);
+        if constexpr (filter_base::filtered) {
+            this->filter_.add(res->key());
+        }
+        if constexpr (index_base::indexed) {
+            this->index_.insert(res);
+        }
         size_++;
+        tally(&tree_stats::allocations);
         return res;
     }
 
+    struct forget_nothing {
+        void operator()(const node *) const noexcept {}
+    };
+
+    // Takes n's key out of the filter and the index, before n is freed
+    void unlist([[maybe_unused]] const node *n) noexcept {
+        if constexpr (filter_base::filtered) {
+            this->filter_.remove(n->key());
+        }
+        if constexpr (index_base::indexed) {
+            this->index_.erase(n);
+        }
+    }
+
+    // Makes room in the index of an indexed tree for keys nodes
+    void reserve_index([[maybe_unused]] size_type keys) {
+        if constexpr (index_base::indexed) {
+            this->index_.reserve(keys);
+        }
+    }
+
+    // Moves the index entries of this tree's nodes, which were just moved
+    // over from other, from other's index into this one's, which has to have
+    // room for them
+    void take_index_entries([[maybe_unused]] bst_base &other) noexcept {
+        if constexpr (index_base::indexed) {
+            for (iterator it = begin(); it != end(); ++it) {
+                other.index_.erase(it.node);
+                this->index_.insert(it.node);
+            }
+        }
+    }
+
+    // The node with key according to the index of an indexed tree, or nullptr
+    [[nodiscard]] node *indexed_node(const Key &key) {
+        return this->index_.find(key, [this, &key](const node *n) {
+            return !less(key, n->key()) && !less(n->key(), key);
+        });
+    }
+
+    // Frees node along with its subtree
     void destroy_node(node *node) {
-        size_--;
-        if (node->left != nullptr) {
-            destroy_node(node->left);
+        size_type freed;
+        if constexpr (filter_base::filtered || index_base::indexed) {
+            freed = free_subtree(get_node_allocator(), node, arena_, [this](const auto *n) { unlist(n); });
+        } else {
+            freed = free_subtree(get_node_allocator(), node, arena_);
         }
-        if (node->right != nullptr) {
-            destroy_node(node->right);
+        size_ -= freed;
+        tally(&tree_stats::deallocations, freed);
+        // None of the block's nodes can be left either
+        if (size_ == 0) {
+            release(allocator, std::exchange(arena_, nullptr));
         }
-        std::allocator_traits<node_allocator>::deallocate(get_node_allocator(), node, 1);
     }
 
-    size_type size_{};
-    node header; // This is needed so that different treaps have different end()s
-    node_allocator allocator{};
+    // Frees every node without taking them out of the filter or the index one
+    // by one, which are about to be dropped whole (or already were)
+    void destroy_tree() noexcept {
+        const size_type freed = free_subtree(get_node_allocator(), header.par, arena_);
+        size_ -= freed;
+        tally(&tree_stats::deallocations, freed);
+    }
 
-#ifndef INSTRUMENT_DEPTH
-    inline static std::minstd_rand generator{}; // NOLINT(cert-msc51-cpp)
-#else
-#if INSTRUMENT_DEPTH == 1
-    inline static std::minstd_rand generator{}; // NOLINT(cert-msc51-cpp)
-#else
-#if INSTRUMENT_DEPTH == 2
-    inline static std::mt19937 generator{}; // NOLINT(cert-msc51-cpp)
-#else
-#if INSTRUMENT_DEPTH == 3
-    inline static std::ranlux24_base generator{}; // NOLINT(cert-msc51-cpp)
-#endif // INSTRUMENT_DEPTH == 3
-#endif // INSTRUMENT_DEPTH == 2
-#endif // INSTRUMENT_DEPTH == 1
-#endif // INSTRUMENT_DEPTH
-};
+    // Frees the subtree at n and returns the number of nodes freed
+    // Iterative and without any extra memory, however deep the tree: while
+    // the top node has a left child it is rotated right, which leaves a top
+    // node without one that can be freed, its right subtree taking its place
+    // Every node is rotated at most once, so this takes O(n). The parent
+    // links aren't kept up to date, as nothing reads them any more
+    // Nodes in nodes are only destroyed, as they go with the whole block
+    // forget is called on every node before it goes
+    template<class Forget = forget_nothing>
+    static size_type free_subtree(node_allocator &alloc, node *n, const arena *nodes, Forget forget = {}) {
+        size_type res = 0;
+        while (n != nullptr) {
+            if (node *const left = n->left; left != nullptr) {
+                n->left = left->right;
+                left->right = n;
+                n = left;
+            } else {
+                node *const right = n->right;
+                forget(n);
+                std::allocator_traits<node_allocator>::destroy(alloc, n);
+                if (nodes == nullptr || !nodes->owns(n)) {
+                    std::allocator_traits<node_allocator>::deallocate(alloc, n, 1);
+                }
+                n = right;
+                res++;
+            }
+        }
+        return res;
+    }
 
-}
+    // Whether key may be in the tree, as far as the filter of a filtered tree
+    // can tell (other trees can't tell at all)
+    // The filter is only resized here, once the tree has outgrown it or shrunk
+    // to an eighth of it, rather than as elements come and go, which can be
+    // in the middle of moving nodes around. So is a filter that was left
+    // empty, e.g. by a copy, filled. O(n), but only after O(n) changes
+    [[nodiscard]] bool may_contain(const Key &key) {
+        if constexpr (filter_base::filtered) {
+            auto &filter = this->filter_;
+            const size_type capacity = filter.capacity();
+            if (size() > capacity || (size() < capacity / 8 && capacity > filter.keys_per_block)) {
+                filter.reset(size() + size() / 2);
+                for (iterator it = begin(); it != end(); ++it) {
+                    filter.add(it.node->key());
+                }
+            }
+            return filter.may_contain(key);
+        } else {
+            return true;
+        }
+    }
 
-#define BST_IMPL TREAP
+    static constexpr bool three_way = is_three_way<Compare, Key>;
 
-#if BST_IMPL == TREAP
-template<
-        class Key,
-        class Compare   = std::less<Key>,
-        class Allocator = std::allocator<Key>
->
-using set = impl::treap<Key, impl::null_type, Compare, Allocator>;
+    // Compare, counted in tree_stats
+    [[nodiscard]] bool less(const Key &lhs, const Key &rhs) {
+        tally(&tree_stats::comparisons);
+        return uncounted_less(lhs, rhs);
+    }
 
-template<
-        class Key,
-        class T,
-        class Compare   = std::less<Key>,
-        class Allocator = std::allocator<std::pair<const Key, T>>
->
-using map = impl::treap<Key, T, Compare, Allocator>;
-#endif
+    static constexpr bool cache_prefix = std::is_base_of_v<prefix_slot<true>, node>;
+
+    // The prefix of a key being looked up, worked out once per lookup
+    // Only used when the nodes cache theirs
+    [[nodiscard]] static std::uint64_t prefix_of([[maybe_unused]] const Key &key) {
+        if constexpr (cache_prefix) {
+            return key_prefix(key);
+        } else {
+            return 0;
+        }
+    }
+
+    // n->key() < key, settled by the cached prefixes when they differ
+    [[nodiscard]] bool node_less(const node *n, const Key &key, [[maybe_unused]] std::uint64_t prefix) {
+        if constexpr (cache_prefix) {
+            if (n->prefix != prefix) {
+                tally(&tree_stats::comparisons);
+                return n->prefix < prefix;
+            }
+        }
+        return less(n->key(), key);
+    }
+
+    // key < n->key(), settled by the cached prefixes when they differ
+    [[nodiscard]] bool less_node(const Key &key, [[maybe_unused]] std::uint64_t prefix, const node *n) {
+        if constexpr (cache_prefix) {
+            if (n->prefix != prefix) {
+                tally(&tree_stats::comparisons);
+                return prefix < n->prefix;
+            }
+        }
+        return less(key, n->key());
+    }
+
+    // Sign of key <=> n->key() for a three-way comparator
+    [[nodiscard]] int order_of(const Key &key, [[maybe_unused]] std::uint64_t prefix, const node *n) {
+        tally(&tree_stats::comparisons);
+        if constexpr (cache_prefix) {
+            if (n->prefix != prefix) {
+                return prefix < n->prefix ? -1 : 1;
+            }
+        }
+        const auto order = this->comparator()(key, n->key());
+        return order < 0 ? -1 : order == 0 ? 0 : 1;
+    }
+
+    // For asserts, which mustn't change the stats
+    [[nodiscard]] bool uncounted_less(const Key &lhs, const Key &rhs) const {
+        if constexpr (three_way) {
+            return this->comparator()(lhs, rhs) < 0;
+        } else {
+            return this->comparator()(lhs, rhs);
+        }
+    }
+
+    // Returns the element with key and true if there is one, and otherwise
+    // lower_bound(key) and false
+    // Equivalence is !(a < b) && !(b < a) as for std::map, not ==
+    // A three-way comparator stops as soon as it meets key, with one call per
+    // node instead of a lower_bound and a final comparison
+    [[nodiscard]] std::pair<iterator, bool> locate(const Key &key) {
+        if constexpr (index_base::indexed) {
+            if (node *const n = indexed_node(key); n != nullptr) {
+                return {iterator{n}, true};
+            }
+        }
+        if constexpr (three_way) {
+            const std::uint64_t prefix = prefix_of(key);
+            node *n = header.par;
+            iterator res = end();
+            while (n != nullptr) {
+                tally(&tree_stats::nodes_visited);
+                const int order = order_of(key, prefix, n);
+                if (order == 0) {
+                    return {iterator{n}, true};
+                }
+                if (order < 0) {
+                    res = iterator{n};
+                    n = n->left;
+                } else {
+                    n = n->right;
+                }
+            }
+            return {res, false};
+        } else {
+            iterator lb = lower_bound(key);
+            return {lb, lb != end() && !less_node(key, prefix_of(key), lb.node)};
+        }
+    }
+
+    // Adds by to a tree_stats counter, compiled out unless BST_STATS is on
+    void tally([[maybe_unused]] std::uint64_t tree_stats::*counter, [[maybe_unused]] std::uint64_t by = 1) {
+        if constexpr (stats_holder<>::enabled) {
+            this->stats_.*counter += by;
+        }
+    }
+
+    // Keeps the maximum instead of adding up
+    void tally_max([[maybe_unused]] std::uint64_t tree_stats::*counter, [[maybe_unused]] std::uint64_t value) {
+        if constexpr (stats_holder<>::enabled) {
+            this->stats_.*counter = std::max(this->stats_.*counter, value);
+        }
+    }
+
+    size_type size_{};
+    node header; // This is needed so that different trees have different end()s
+    node_allocator allocator{};
+    // Where compact() last put the nodes, if anywhere
+    arena *arena_{};
+
+private:
+    [[nodiscard]] Derived &derived() {
+        return static_cast<Derived &>(*this);
+    }
+};
+
+// With CachePrefix, the key_prefix() of the key comes first, so that it
+// shares a cache line with the links
+template<class T, bool Interval, bool Prioritized>
+struct treap_balance : interval_slot<T, Interval>, priority_slot<T, Prioritized> {
+    std::uint32_t pri{};
+    // Number of nodes in the subtree, only kept up to date by multi treaps
+    // Like pri, it fits in what would otherwise be padding
+    std::uint32_t size{1};
+};
+
+template<class Key, class T, bool CachePrefix = false, bool Interval = false, bool Prioritized = false>
+struct treap_node : prefix_slot<CachePrefix>,
+                    node_base<Key, T, treap_node<Key, T, CachePrefix, Interval, Prioritized>,
+                              treap_balance<T, Interval, Prioritized>> {
+    using priority = std::uint32_t;
+
+    using node_base<Key, T, treap_node, treap_balance<T, Interval, Prioritized>>::node_base;
+};
+
+// TODO: 1. Extend with extra stuff like tree-order statistics
+// When Adaptive is set, find() and lower_bound() raise the priority of the
+// element they return, so frequently used keys move up towards the root
+// Each access redraws the priority and keeps the larger value, so an element
+// accessed k times has the maximum of k + 1 random draws as priority. This is
+// the weighted treap of Seidel and Aragon: expected depth O(log(W / w)) for an
+// element of weight w out of a total weight W, without ever going below that
+// of an ordinary treap
+// When Multi is set, keys don't have to be unique. Each node then keeps the
+// size of its subtree, so that count() takes O(log n) and erase(key) removes
+// every element with key at once with two splits and a merge. Multi treaps
+// hold at most UINT32_MAX elements
+// When TopDown is set, insert() goes down from the root only until the new
+// priority beats the current node's, splits the subtree there around the key
+// and hangs the halves off the new node, instead of linking the new node in
+// as a leaf and rotating it up. Multi treaps always insert bottom-up, as the
+// position given to a hinted insert matters among equivalent keys
+// When Interval is set, each element is the closed interval [key, mapped]
+// and each node keeps the largest end in its subtree, so that the intervals
+// overlapping a range can be found without looking at the ones that end
+// before it. Ends mustn't be changed in place, through iterators or
+// otherwise, as the largest ends wouldn't follow. Interval treaps insert
+// bottom-up too
+// When Prioritized is set, the mapped value is a priority ordered by
+// std::less<T> and each node keeps the smallest and largest priority in its
+// subtree, so that the best priority among a range of keys, or every element
+// of a range above or below some priority, can be found without looking at
+// subtrees that can't have any. The tree is still balanced by the random
+// priorities, as user-supplied ones (timestamps, say) would let it degenerate.
+// Priorities have to be changed with set_priority() or parallel_transform(),
+// not through iterators. Prioritized treaps insert bottom-up too
+// When Filtered is set, find(), count() and contains() check a counting Bloom
+// filter over the keys first, see bst_base
+// When Indexed is set, a hash table from keys to nodes answers find() and
+// tells insert() and operator[] about keys already there, see bst_base. Only
+// for unique keys
+template<class Key, class T, class Compare, class Allocator, bool Adaptive = false, bool Multi = false,
+         bool TopDown = BST_TREAP_INSERT == BST_TOP_DOWN, bool Interval = false, bool Prioritized = false,
+         bool Filtered = false, bool Indexed = false>
+class treap : public bst_base<Key, T, Compare, Allocator,
+                              treap_node<Key, T, use_key_prefix<Key, Compare>, Interval, Prioritized>,
+                              treap<Key, T, Compare, Allocator, Adaptive, Multi, TopDown, Interval, Prioritized,
+                                    Filtered, Indexed>,
+                              Filtered, Indexed> {
+private:
+    using base = bst_base<Key, T, Compare, Allocator,
+                          treap_node<Key, T, use_key_prefix<Key, Compare>, Interval, Prioritized>, treap, Filtered,
+                          Indexed>;
+    friend base;
+
+    using typename base::node;
+    using base::header;
+    using base::root;
+
+public:
+    using typename base::value_type;
+    using typename base::size_type;
+    using typename base::iterator;
+    using typename base::const_iterator;
+    using insert_result = std::conditional_t<Multi, iterator, std::pair<iterator, bool>>;
+
+    using base::erase;
+
+    treap() : treap(Compare()) {}
+
+    explicit treap(const Compare &comp, const Allocator &alloc = Allocator()) : base(comp, alloc) {
+        header.pri = UINT32_MAX;
+    }
+
+    // Multi treaps always insert, after every element with an equivalent key
+    // like std::multimap, and just return an iterator to the new element
+    insert_result insert(const value_type &value) {
+        if constexpr (Multi) {
+            return insert_(base::upper_bound(this->key_of(value)), value);
+        } else if constexpr (top_down) {
+            return insert_top_down(value, true);
+        } else {
+            return base::insert(value);
+        }
+    }
+
+    // Inserts value in the position as close as possible to the position
+    // just prior to pos
+    iterator insert(const_iterator pos, const value_type &value) {
+        if constexpr (Multi) {
+            // Use the hint if value fits between std::prev(pos) and pos
+            const Key &key = this->key_of(value);
+            if ((pos != this->end() && this->less(pos.node->key(), key))
+                    || (pos != this->begin() && this->less(key, std::prev(pos).node->key()))) {
+                pos = base::upper_bound(key);
+            }
+            return insert_(pos, value);
+        } else {
+            return base::insert(pos, value);
+        }
+    }
+
+    // Returns the number of elements removed
+    // Multi treaps split out the elements with key and free them in one go,
+    // so this takes O(log n) plus the time to destroy them
+    size_type erase(const Key &key) {
+        if constexpr (Multi) {
+            const auto [first, last] = base::equal_range(key);
+            const size_type old_size = this->size();
+            erase(first, last);
+            return old_size - this->size();
+        } else {
+            return base::erase(key);
+        }
+    }
+
+    // Removes the elements in [first, last)
+    // The range is split out of the tree in O(log n) and then freed in one go,
+    // without rebalancing after each element
+    // Returns the iterator following the last removed element
+    iterator erase(const_iterator first, const_iterator last) {
+        if (first != last) {
+            this->destroy_node(detach(first, last));
+        }
+        return last;
+    }
+
+    // Moves the elements in [first, last) into a new treap of their own,
+    // without copying or reallocating them
+    // Iterators to the moved elements stay valid, but now belong to the result
+    // O(log n), plus O(k) for the k moved elements unless this is a multi treap
+    [[nodiscard]] treap extract_range(const_iterator first, const_iterator last) {
+        treap res(this->key_comp());
+        res.allocator = this->allocator;
+        if (first == last) {
+            return res;
+        }
+        size_type count;
+        if constexpr (Multi) {
+            count = index_of(last) - index_of(first);
+        } else {
+            count = static_cast<size_type>(std::distance(first, last));
+        }
+        res.reserve_index(count);
+        res.header.par = detach(first, last);
+        res.header.par->par = &res.header;
+        res.arena_ = base::share(this->arena_);
+        res.header.left = base::leftmost_of(res.header.par);
+        res.header.right = base::rightmost_of(res.header.par);
+        res.size_ = count;
+        this->size_ -= count;
+        if (this->size_ == 0) {
+            base::release(this->allocator, std::exchange(this->arena_, nullptr));
+        }
+        res.take_index_entries(*this);
+        return res;
+    }
+
+    // Inserts the elements of [first, last) as insert() would one by one: of
+    // several elements with equivalent keys the first wins, and none replaces
+    // an element already in the tree. Returns the number inserted
+    // The batch is sorted on pool and deduplicated, built into a treap of its
+    // own in O(m) and then unioned into this one, with the subtrees of the
+    // union worked out on pool too, for O(m log(n / m + 1)) work in total
+    // Multi treaps keep every element instead, each one after those with an
+    // equivalent key already there or earlier in the batch. The batch is
+    // only sorted on pool, then inserted one element at a time
+    template<class InputIt>
+    size_type insert_bulk(InputIt first, InputIt last, size_type grain = base::DEFAULT_GRAIN,
+                          thread_pool &pool = thread_pool::shared()) {
+        if constexpr (Multi) {
+            auto batch = this->sorted_batch(first, last, grain, pool, false);
+            for (auto &value : batch) {
+                const value_type element(std::move(value));
+                std::ignore = insert_(base::upper_bound(this->key_of(element)), element);
+            }
+            return batch.size();
+        } else {
+            auto batch = this->sorted_batch(first, last, grain, pool);
+            if (batch.empty()) {
+                return 0;
+            }
+            const size_type old_size = this->size();
+            std::vector<node *> nodes;
+            nodes.reserve(batch.size());
+            try {
+                for (auto &value : batch) {
+                    node *const n = this->create_node(value_type(std::move(value)), nullptr);
+                    n->pri = new_priority();
+                    if constexpr (use_key_prefix<Key, Compare>) {
+                        n->prefix = key_prefix(n->key());
+                    }
+                    nodes.push_back(n);
+                }
+            } catch (...) {
+                for (node *n : nodes) {
+                    this->destroy_node(n);
+                }
+                throw;
+            }
+            duplicate_list duplicates;
+            header.par = unite(header.par, relink(nodes), this->size(), std::max<size_type>(grain, 1), pool,
+                               duplicates);
+            header.par->par = &header;
+            header.left = base::leftmost_of(header.par);
+            header.right = base::rightmost_of(header.par);
+            for (node *n : duplicates.nodes) {
+                this->destroy_node(n);
+            }
+            return this->size() - old_size;
+        }
+    }
+
+    // Writes the tree to out, priorities included, so that load() can rebuild
+    // exactly the same tree. Keys and mapped values go through bst::serializer
+    // Nodes are written in pre-order, each one as a byte telling which
+    // children it has, its priority, its key and its mapped value
+    void save(std::ostream &out) const {
+        impl::snapshot_writer writer(out);
+        save_to(writer);
+    }
+
+    // Replaces the contents with a snapshot written by save(), in O(n)
+    // without any comparison or rotation
+    // The snapshot is trusted to be in key order, but one for another key or
+    // mapped type, another byte order or another version of the format is
+    // rejected, as is a truncated one. Throws snapshot_error and leaves the
+    // tree as it was if it can't be read
+    void load(std::istream &in) {
+        impl::snapshot_reader reader(in);
+        load_from(reader);
+    }
+
+#ifdef BST_HAS_FD
+    // Same as save(std::ostream &), but written straight to the file
+    // descriptor fd from its current offset, without a stream in between
+    void save(int fd) const {
+        impl::snapshot_writer writer(fd);
+        save_to(writer);
+    }
+
+    // Same as load(std::istream &), but read from the file descriptor fd from
+    // its current offset. As it reads a megabyte at a time, the offset may
+    // end up past the end of the snapshot
+    void load(int fd) {
+        impl::snapshot_reader reader(fd);
+        load_from(reader);
+    }
+#endif
+
+    // Returns the number of elements with key
+    // O(log n) in multi treaps, which count through subtree sizes
+    [[nodiscard]] size_type count(const Key &key) {
+        if constexpr (Multi) {
+            if (!this->may_contain(key)) {
+                return 0;
+            }
+            return rank(key, true) - rank(key, false);
+        } else {
+            return base::count(key);
+        }
+    }
+
+    // Finds an element with key equivalent to key
+    [[nodiscard]] iterator find(const Key &key) {
+        return touch(base::find(key));
+    }
+
+    // Returns an iterator pointing to the first element that is not less than
+    // (i.e. greater or equal to) key
+    [[nodiscard]] iterator lower_bound(const Key &key) {
+        return touch(base::lower_bound(key));
+    }
+
+    // Interval treaps can't hand out ends to be assigned to, as the largest
+    // ends kept in the nodes wouldn't follow. Erase and insert instead
+    // Neither can prioritized treaps, which have set_priority() for it
+    // Multimaps have none, like std::multimap, as the key may match several
+    template<class U = T, std::enable_if_t<!is_null_type<U>, bool> = true>
+    U &operator[](const Key &key) {
+        static_assert(!Multi, "a multimap has no operator[], use insert() or find()");
+        static_assert(!Interval, "the ends of an interval treap can't be assigned to");
+        static_assert(!Prioritized, "the priorities of a priority map are changed with set_priority()");
+        return base::operator[](key);
+    }
+
+    // Sets the mapped value of every element to f(element)
+    // Interval treaps and priority maps then work the largest ends or the
+    // smallest and largest priorities out again, from the leaves up, which
+    // takes O(n) on the calling thread
+    template<class F, class U = T, std::enable_if_t<!is_null_type<U>, bool> = true>
+    void parallel_transform(F f, size_type grain = base::DEFAULT_GRAIN, thread_pool &pool = thread_pool::shared()) {
+        base::parallel_transform(std::move(f), grain, pool);
+        if constexpr (Interval || Prioritized) {
+            update_subtree(header.par);
+        }
+    }
+
+    // Calls f on every interval [start, end] that overlaps [lo, hi], i.e.
+    // with start <= hi and end >= lo, in order of start
+    // Subtrees whose largest end is below lo are skipped and the walk stops
+    // at the first start past hi, so this takes O(log n) per interval found
+    // f gets the intervals as const, as changing an end would go unnoticed
+    template<class F, bool I = Interval, std::enable_if_t<I, bool> = true>
+    void for_each_overlapping(const Key &lo, const Key &hi, F f) {
+        visit_overlapping(lo, hi, [&f](const value_type &value) {
+            f(value);
+            return true;
+        });
+    }
+
+    // Calls f on every interval that contains point, in order of start
+    template<class F, bool I = Interval, std::enable_if_t<I, bool> = true>
+    void for_each_containing(const Key &point, F f) {
+        for_each_overlapping(point, point, std::move(f));
+    }
+
+    // Whether any interval overlaps [lo, hi]. O(log n)
+    template<bool I = Interval, std::enable_if_t<I, bool> = true>
+    [[nodiscard]] bool overlaps(const Key &lo, const Key &hi) {
+        bool found = false;
+        visit_overlapping(lo, hi, [&found](const value_type &) {
+            found = true;
+            return false;
+        });
+        return found;
+    }
+
+    // Returns the element with the largest priority, the one with the
+    // smallest key among equals, or end() if the tree is empty. O(log n)
+    // erase(max_priority()) pops it like a heap would
+    template<bool P = Prioritized, std::enable_if_t<P, bool> = true>
+    [[nodiscard]] iterator max_priority() {
+        return header.par != nullptr ? iterator{best_of<true>(header.par)} : this->end();
+    }
+
+    // Returns the element with the smallest priority, or end() if the tree is
+    // empty. O(log n)
+    template<bool P = Prioritized, std::enable_if_t<P, bool> = true>
+    [[nodiscard]] iterator min_priority() {
+        return header.par != nullptr ? iterator{best_of<false>(header.par)} : this->end();
+    }
+
+    // Returns the element with the largest priority among the keys in
+    // [lo, hi), the one with the smallest key among equals, or end() if there
+    // are no such keys. O(log n)
+    template<bool P = Prioritized, std::enable_if_t<P, bool> = true>
+    [[nodiscard]] iterator max_priority(const Key &lo, const Key &hi) {
+        return best_in_range<true>(lo, hi);
+    }
+
+    // Returns the element with the smallest priority among the keys in
+    // [lo, hi), or end() if there are no such keys. O(log n)
+    template<bool P = Prioritized, std::enable_if_t<P, bool> = true>
+    [[nodiscard]] iterator min_priority(const Key &lo, const Key &hi) {
+        return best_in_range<false>(lo, hi);
+    }
+
+    // Calls f on every element with a key in [lo, hi) and a priority not less
+    // than pri, in key order
+    // Subtrees whose largest priority is below pri are skipped, so this
+    // takes O(log n) per element found
+    template<class F, bool P = Prioritized, std::enable_if_t<P, bool> = true>
+    void for_each_priority_at_least(const Key &lo, const Key &hi, const T &pri, F f) {
+        visit_prioritized<true>(lo, hi, pri, f);
+    }
+
+    // Calls f on every element with a key in [lo, hi) and a priority not
+    // greater than pri, in key order
+    template<class F, bool P = Prioritized, std::enable_if_t<P, bool> = true>
+    void for_each_priority_at_most(const Key &lo, const Key &hi, const T &pri, F f) {
+        visit_prioritized<false>(lo, hi, pri, f);
+    }
+
+    // Changes the priority of the element at pos. O(log n)
+    template<bool P = Prioritized, std::enable_if_t<P, bool> = true>
+    void set_priority(iterator pos, T pri) {
+        pos.node->record.second = std::move(pri);
+        update_path(pos.node);
+    }
+
+    // Halves the weight of every element and rebuilds the tree around the
+    // new priorities, so keys that went cold sink back down. O(n)
+    // Lookups decay the tree a few elements at a time by themselves (see
+    // decay_period()), so this is only needed to age everything at once
+    template<bool A = Adaptive, std::enable_if_t<A, bool> = true>
+    void decay() {
+        decay_debt_ = 0;
+        decay_next_.reset();
+        if (this->empty()) {
+            return;
+        }
+        std::vector<node *> nodes;
+        nodes.reserve(this->size());
+        for (iterator it = this->begin(); it != this->end(); ++it) {
+            it.node->pri = decayed(it.node->pri);
+            nodes.push_back(it.node);
+        }
+        header.par = relink(nodes);
+        header.par->par = &header;
+    }
+
+    // Every element's weight is halved once every decay_period() accesses
+    // Rather than all at once, which would stall the lookup that happens to
+    // run it, find() and lower_bound() halve the weights of the next few
+    // elements in key order whenever DECAY_STEP elements or more are due,
+    // each in O(log n) expected. A full sweep of the tree takes
+    // decay_period() accesses
+    // 0, the default, means size() accesses, so that a lookup ages one element
+    // on average
+    template<bool A = Adaptive, std::enable_if_t<A, bool> = true>
+    [[nodiscard]] size_type decay_period() const noexcept {
+        return decay_period_ != 0 ? decay_period_ : this->size();
+    }
+
+    template<bool A = Adaptive, std::enable_if_t<A, bool> = true>
+    void set_decay_period(size_type period) noexcept {
+        decay_period_ = period;
+    }
+
+private:
+    // The priority has to fit in what would otherwise be padding
+    static_assert(Interval || Prioritized || sizeof(typename base::value_type) != 8 || sizeof(node) == 40);
+    static_assert(!Interval || std::is_same_v<Key, T>, "an interval treap maps starts to ends of the same type");
+    static_assert(!Prioritized || !is_null_type<T>, "a priority map needs mapped values to order by");
+    static_assert(!(Interval && Prioritized), "a treap cannot be both an interval treap and a priority map");
+    // The index holds a single node per key
+    static_assert(!(Multi && Indexed), "a treap cannot be both multi and indexed");
+    // decay() relinks the whole tree without keeping subtree sizes
+    static_assert(!(Adaptive && Multi), "a treap cannot be both adaptive and multi");
+
+    using priority = typename node::priority;
+
+    // Elements aged at once by lookups, see decay_period()
+    static constexpr size_type DECAY_STEP = 64;
+
+    // Squaring a priority p in [0, 1) halves its weight, since
+    // P(p^2 < x) = P(p < x^(1/2)) = x^(k/2) for the maximum of k draws
+    // One more draw keeps every weight at least that of a new element
+    [[nodiscard]] static priority decayed(priority pri) {
+        const auto squared = static_cast<priority>((std::uint64_t{pri} * pri) >> 32);
+        return std::max(squared, new_priority());
+    }
+
+    [[nodiscard]] static priority new_priority() {
+        if constexpr (Adaptive) {
+            // Spread over the full range so that squaring in decay() is exact
+            return static_cast<priority>(generator()) << 1;
+        } else {
+            return generator();
+        }
+    }
+
+    // In-order walk over the intervals overlapping [lo, hi] with an explicit
+    // stack, until f returns false
+    template<class F>
+    void visit_overlapping(const Key &lo, const Key &hi, F f) {
+        std::vector<node *> stack;
+        node *n = header.par;
+        for (;;) {
+            // Only go down into subtrees that reach lo
+            for (; n != nullptr && !this->less(n->max_end, lo); n = n->left) {
+                this->tally(&tree_stats::nodes_visited);
+                stack.push_back(n);
+            }
+            if (stack.empty()) {
+                return;
+            }
+            n = stack.back();
+            stack.pop_back();
+            // Everything from here on starts past hi
+            if (this->less(hi, n->key())) {
+                return;
+            }
+            if (!this->less(n->record.second, lo) && !f(std::as_const(n->record))) {
+                return;
+            }
+            n = n->right;
+        }
+    }
+
+    // Whether priority a is strictly better than b, i.e. greater when looking
+    // for the largest and less when looking for the smallest
+    template<bool Max>
+    [[nodiscard]] static bool beats(const T &a, const T &b) {
+        return Max ? std::less<T>{}(b, a) : std::less<T>{}(a, b);
+    }
+
+    // The best priority in the subtree at n
+    template<bool Max>
+    [[nodiscard]] static const T &best_priority(const node *n) {
+        if constexpr (Max) {
+            return n->max_pri;
+        } else {
+            return n->min_pri;
+        }
+    }
+
+    // Follows the best priority of the subtree at n down to its node, going
+    // left on ties so as to find the one with the smallest key
+    template<bool Max>
+    [[nodiscard]] node *best_of(node *n) {
+        const T &best = best_priority<Max>(n);
+        for (;;) {
+            this->tally(&tree_stats::nodes_visited);
+            if (n->left != nullptr && !beats<Max>(best, best_priority<Max>(n->left))) {
+                n = n->left;
+            } else if (!beats<Max>(best, n->record.second)) {
+                return n;
+            } else {
+                n = n->right;
+            }
+        }
+    }
+
+    // Splits [lo, hi) into O(log n) nodes and whole subtrees, in key order,
+    // by going down to the first node in range and then along the paths to
+    // lo and hi from there, and picks the best among them
+    template<bool Max>
+    [[nodiscard]] iterator best_in_range(const Key &lo, const Key &hi) {
+        node *top = header.par;
+        while (top != nullptr) {
+            this->tally(&tree_stats::nodes_visited);
+            if (this->less(top->key(), lo)) {
+                top = top->right;
+            } else if (!this->less(top->key(), hi)) {
+                top = top->left;
+            } else {
+                break;
+            }
+        }
+        if (top == nullptr) {
+            return this->end();
+        }
+        // A part is either a single node or (whole) the subtree at it
+        struct part {
+            node *n;
+            bool whole;
+        };
+        std::vector<part> parts;
+        // Everything right of a node not less than lo is in range, up to top.
+        // The path goes down towards smaller keys, so it is reversed below
+        for (node *n = top->left; n != nullptr;) {
+            this->tally(&tree_stats::nodes_visited);
+            if (this->less(n->key(), lo)) {
+                n = n->right;
+            } else {
+                if (n->right != nullptr) {
+                    parts.push_back({n->right, true});
+                }
+                parts.push_back({n, false});
+                n = n->left;
+            }
+        }
+        std::reverse(parts.begin(), parts.end());
+        parts.push_back({top, false});
+        // And everything left of a node less than hi, from top on
+        for (node *n = top->right; n != nullptr;) {
+            this->tally(&tree_stats::nodes_visited);
+            if (this->less(n->key(), hi)) {
+                if (n->left != nullptr) {
+                    parts.push_back({n->left, true});
+                }
+                parts.push_back({n, false});
+                n = n->right;
+            } else {
+                n = n->left;
+            }
+        }
+        const part *best = &parts.front();
+        const auto priority_of = [](const part &p) -> const T & {
+            return p.whole ? best_priority<Max>(p.n) : p.n->record.second;
+        };
+        for (const part &p : parts) {
+            if (beats<Max>(priority_of(p), priority_of(*best))) {
+                best = &p;
+            }
+        }
+        return iterator{best->whole ? best_of<Max>(best->n) : best->n};
+    }
+
+    // In-order walk over the elements with a key in [lo, hi) and a priority
+    // pri or better, with an explicit stack, skipping the subtrees whose best
+    // priority is worse and those left of lo
+    template<bool Max, class F>
+    void visit_prioritized(const Key &lo, const Key &hi, const T &pri, F &f) {
+        std::vector<node *> stack;
+        node *n = header.par;
+        for (;;) {
+            while (n != nullptr && !beats<Max>(pri, best_priority<Max>(n))) {
+                this->tally(&tree_stats::nodes_visited);
+                if (this->less(n->key(), lo)) {
+                    n = n->right;
+                } else {
+                    stack.push_back(n);
+                    n = n->left;
+                }
+            }
+            if (stack.empty()) {
+                return;
+            }
+            n = stack.back();
+            stack.pop_back();
+            if (!this->less(n->key(), hi)) {
+                return;
+            }
+            if (!beats<Max>(pri, n->record.second)) {
+                f(std::as_const(n->record));
+            }
+            n = n->right;
+        }
+    }
+
+    // Adds one draw to the priority of it and rotates it up past every parent
+    // it now outranks
+    iterator touch(iterator it) {
+        if constexpr (Adaptive) {
+            if (it == this->end()) {
+                return it;
+            }
+            if (const priority pri = new_priority(); it.node->pri < pri) {
+                it.node->pri = pri;
+                sift_up(it.node);
+            }
+            // Each access is owed size() / decay_period() agings, counted
+            // in units of 1 / decay_period() to stay exact
+            const size_type period = std::max<size_type>(decay_period(), 1);
+            decay_debt_ += this->size();
+            if (const size_type due = decay_debt_ / period; due >= std::min(DECAY_STEP, this->size())) {
+                decay_some(due);
+                decay_debt_ %= period;
+            }
+        }
+        return it;
+    }
+
+    // Halves the weight of the count elements after the last one aged,
+    // wrapping around at the end, and moves each one down or, should the
+    // extra draw in decayed() have raised it, up to where its new priority
+    // belongs. Rotations keep the elements in order, so the next one is where
+    // the walk continues
+    // The walk remembers the key it stopped at rather than its node, which
+    // erase() may free. Should that copy throw, it starts over from begin()
+    void decay_some(size_type count) {
+        iterator it = decay_next_ ? base::lower_bound(*decay_next_) : this->begin();
+        for (count = std::min(count, this->size()); count > 0; count--) {
+            if (it == this->end()) {
+                it = this->begin();
+            }
+            node *const n = it.node;
+            ++it;
+            const priority old = n->pri;
+            n->pri = decayed(old);
+            if (old < n->pri) {
+                sift_up(n);
+            } else {
+                sift_down(n);
+            }
+        }
+        try {
+            decay_next_.reset();
+            if (it != this->end()) {
+                decay_next_.emplace(it.node->key());
+            }
+        } catch (...) {
+            decay_next_.reset();
+        }
+    }
+
+    // Rotates n down below every child that now outranks it, the higher one
+    // first, until it is a leaf or outranks both
+    void sift_down(node *n) {
+        for (;;) {
+            node *child = n->left;
+            if (n->right != nullptr && (child == nullptr || child->pri < n->right->pri)) {
+                child = n->right;
+            }
+            if (child == nullptr || child->pri <= n->pri) {
+                return;
+            }
+            if (child == n->left) {
+                this->rotate_right(n, child);
+            } else {
+                this->rotate_left(n, child);
+            }
+            // n is now a child of child
+            update_node(n);
+            update_node(child);
+        }
+    }
+
+    // Rotates n up until its parent has a priority at least as high
+    // Strict inequality so we won't rotate out header
+    void sift_up(node *n) {
+        iterator it{n};
+        iterator par{it.node->par};
+        while (par.node->pri < it.node->pri) {
+            assert(par.node != &header); // Rotates will mess up
+            if (par.node->left == it.node) {
+                this->rotate_right(par.node, it.node);
+            } else {
+                assert(par.node->right == it.node);
+                this->rotate_left(par.node, it.node);
+            }
+            // par is now a child of it
+            update_node(par.node);
+            update_node(it.node);
+            par.node = it.node->par;
+        }
+    }
+
+    // Snapshot flags: which children follow a node
+    static constexpr unsigned char HAS_LEFT = 1;
+    static constexpr unsigned char HAS_RIGHT = 2;
+
+    [[nodiscard]] static impl::snapshot_header snapshot_header_of(std::uint64_t count) {
+        impl::snapshot_header res{};
+        std::memcpy(res.magic, impl::snapshot_header::MAGIC, sizeof res.magic);
+        res.version = impl::snapshot_header::VERSION;
+        res.byte_order = impl::snapshot_header::ORDER_MARK;
+        res.key_size = sizeof(Key);
+        if constexpr (!is_null_type<T>) {
+            res.mapped_size = sizeof(T);
+        }
+        res.multi = Multi;
+        res.count = count;
+        return res;
+    }
+
+    void save_to(impl::snapshot_writer &writer) const {
+        const impl::snapshot_header head = snapshot_header_of(this->size());
+        writer.write_bytes(&head, sizeof head);
+        // Pre-order with an explicit stack, so that even a degenerate tree
+        // can't overflow the call stack
+        std::vector<const node *> stack;
+        if (header.par != nullptr) {
+            stack.push_back(header.par);
+        }
+        while (!stack.empty()) {
+            const node *const n = stack.back();
+            stack.pop_back();
+            const unsigned char flags = (n->left != nullptr ? HAS_LEFT : 0) | (n->right != nullptr ? HAS_RIGHT : 0);
+            writer.write_bytes(&flags, sizeof flags);
+            writer.write_bytes(&n->pri, sizeof n->pri);
+            serializer<Key>::write(writer, n->key());
+            if constexpr (!is_null_type<T>) {
+                serializer<T>::write(writer, n->record.second);
+            }
+            // Left on top, so that it is written right after n
+            if (n->right != nullptr) {
+                stack.push_back(n->right);
+            }
+            if (n->left != nullptr) {
+                stack.push_back(n->left);
+            }
+        }
+        writer.flush();
+    }
+
+    // Replaces the contents with the snapshot in reader, leaving them as they
+    // were if it can't be read
+    void load_from(impl::snapshot_reader &reader) {
+        impl::snapshot_header head;
+        reader.read_bytes(&head, sizeof head);
+        const impl::snapshot_header expected = snapshot_header_of(head.count);
+        if (std::memcmp(&head, &expected, sizeof head) != 0) {
+            throw snapshot_error("bst: snapshot is of another format or type");
+        }
+        // Nodes are linked in as soon as they are made, so that everything
+        // read so far can be freed if this throws
+        treap res(this->key_comp());
+        res.allocator = this->allocator;
+        res.decay_period_ = decay_period_;
+        if (head.count != 0) {
+            try {
+                res.load_nodes(reader, head.count);
+            } catch (...) {
+                if (res.header.par != nullptr) {
+                    res.destroy_node(res.header.par);
+                    res.reset_header();
+                }
+                throw;
+            }
+            res.header.left = base::leftmost_of(res.header.par);
+            res.header.right = base::rightmost_of(res.header.par);
+        }
+        if (res.size() != head.count) {
+            throw snapshot_error("bst: snapshot holds the wrong number of elements");
+        }
+        this->swap(res);
+    }
+
+    // Reads the nodes written by save_to() into this tree, which has to be
+    // empty, linking each one in as soon as it is made
+    // Stops at limit nodes in total, so a corrupt snapshot can't make it run
+    // on until memory runs out. Goes through the snapshot with an explicit
+    // stack of the links still to fill, as a snapshot whose priorities form a
+    // long chain would otherwise recurse once per node
+    void load_nodes(impl::snapshot_reader &reader, std::uint64_t limit) {
+        // Each link still to fill, with the node it belongs to
+        struct pending {
+            node **dst;
+            node *par;
+        };
+        std::vector<pending> stack{{&header.par, &header}};
+        while (!stack.empty()) {
+            const pending next = stack.back();
+            stack.pop_back();
+            if (this->size() == limit) {
+                throw snapshot_error("bst: snapshot holds the wrong number of elements");
+            }
+            unsigned char flags;
+            reader.read_bytes(&flags, sizeof flags);
+            priority pri;
+            reader.read_bytes(&pri, sizeof pri);
+            if ((flags & ~(HAS_LEFT | HAS_RIGHT)) != 0 || pri > next.par->pri) {
+                throw snapshot_error("bst: snapshot is corrupt");
+            }
+            Key key = serializer<Key>::read(reader);
+            node *n;
+            if constexpr (is_null_type<T>) {
+                n = this->create_node(std::move(key), next.par);
+            } else {
+                T mapped = serializer<T>::read(reader);
+                n = this->create_node(value_type(std::move(key), std::move(mapped)), next.par);
+            }
+            *next.dst = n;
+            n->pri = pri;
+            if constexpr (use_key_prefix<Key, Compare>) {
+                n->prefix = key_prefix(n->key());
+            }
+            if ((flags & HAS_RIGHT) != 0) {
+                stack.push_back({&n->right, n});
+            }
+            if ((flags & HAS_LEFT) != 0) {
+                stack.push_back({&n->left, n});
+            }
+        }
+        if constexpr (augmented) {
+            update_subtree(header.par);
+        }
+    }
+
+    [[nodiscard]] static size_type subtree_size(const node *n) {
+        return n != nullptr ? n->size : 0;
+    }
+
+    // Whether nodes keep anything about their subtrees
+    static constexpr bool augmented = Multi || Interval || Prioritized;
+
+    // Recomputes what n keeps about its subtree from its children: the size in
+    // multi treaps, the largest end in interval treaps, the smallest and
+    // largest priority in priority maps
+    // Comparisons aren't counted, as unite() calls this on several threads
+    void update_node(node *n) {
+        if constexpr (Multi) {
+            n->size = static_cast<std::uint32_t>(subtree_size(n->left) + subtree_size(n->right) + 1);
+        }
+        if constexpr (Interval) {
+            const T *max_end = &n->record.second;
+            for (const node *child : {n->left, n->right}) {
+                if (child != nullptr && this->uncounted_less(*max_end, child->max_end)) {
+                    max_end = &child->max_end;
+                }
+            }
+            n->max_end = *max_end;
+        }
+        if constexpr (Prioritized) {
+            const T *min_pri = &n->record.second;
+            const T *max_pri = &n->record.second;
+            for (const node *child : {n->left, n->right}) {
+                if (child != nullptr) {
+                    min_pri = beats<false>(child->min_pri, *min_pri) ? &child->min_pri : min_pri;
+                    max_pri = beats<true>(child->max_pri, *max_pri) ? &child->max_pri : max_pri;
+                }
+            }
+            n->min_pri = *min_pri;
+            n->max_pri = *max_pri;
+        }
+    }
+
+    // Updates n and every ancestor of it, after n's subtree has changed
+    void update_path(node *n) {
+        if constexpr (augmented) {
+            for (; n != &header; n = n->par) {
+                update_node(n);
+            }
+        }
+    }
+
+    // Updates every node of the subtree at n, children before their parents,
+    // after the mapped values in it have changed. O(n), without recursion
+    void update_subtree(node *n) {
+        if (n == nullptr) {
+            return;
+        }
+        // Breadth-first, so that every node comes after its parent
+        std::vector<node *> nodes{n};
+        for (size_type i = 0; i < nodes.size(); i++) {
+            for (node *child : {nodes[i]->left, nodes[i]->right}) {
+                if (child != nullptr) {
+                    nodes.push_back(child);
+                }
+            }
+        }
+        for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+            update_node(*it);
+        }
+    }
+
+    // Returns the number of elements less than key, or not greater than key
+    // with or_equal. O(log n) through subtree sizes
+    [[nodiscard]] size_type rank(const Key &key, bool or_equal) {
+        size_type res = 0;
+        node *n = header.par;
+        while (n != nullptr) {
+            if (or_equal ? !this->less(key, n->key()) : this->less(n->key(), key)) {
+                res += subtree_size(n->left) + 1;
+                n = n->right;
+            } else {
+                n = n->left;
+            }
+        }
+        return res;
+    }
+
+    // Position of pos in key order, end() being at size()
+    // O(log n) through subtree sizes
+    [[nodiscard]] size_type index_of(const_iterator pos) const {
+        if (pos == this->end()) {
+            return this->size();
+        }
+        const node *n = pos.node;
+        size_type res = subtree_size(n->left);
+        for (; n->par != &header; n = n->par) {
+            if (n->par->right == n) {
+                res += subtree_size(n->par->left) + 1;
+            }
+        }
+        return res;
+    }
+
+    // Unlinks [first, last), which must not be empty, with two splits and a
+    // merge, and returns the root of the detached subtree
+    // begin() and rightmost() are kept up to date, size() is left to the caller
+    [[nodiscard]] node *detach(const_iterator first, const_iterator last) {
+        assert(first != last);
+        // They have to be worked out while the range is still linked
+        node *const new_begin = first == this->begin() ? last.node : header.left;
+        node *const new_rightmost = last != this->end() ? header.right
+                                    : first == this->begin() ? &header : std::prev(first).node;
+        node *lhs;
+        node *mid;
+        node *rhs;
+        if constexpr (Multi) {
+            // Equivalent keys can't tell the split points apart, positions can
+            const size_type lo = index_of(first);
+            const size_type hi = index_of(last);
+            std::tie(lhs, rhs) = split_at(header.par, lo);
+            std::tie(mid, rhs) = split_at(rhs, hi - lo);
+        } else {
+            std::tie(lhs, rhs) = split(header.par, first.node->key());
+            if (last != this->end()) {
+                std::tie(mid, rhs) = split(rhs, last.node->key());
+            } else {
+                mid = std::exchange(rhs, nullptr);
+            }
+        }
+        header.par = merge(lhs, rhs);
+        this->fix_header();
+        if (header.par != nullptr) {
+            header.left = new_begin;
+            header.right = new_rightmost;
+        }
+        mid->par = nullptr;
+        return mid;
+    }
+
+    // Auxiliary operation: Time complexity O(log n)
+    // Splits the subtree at t into its first k elements and the rest, and
+    // returns their roots. Needs subtree sizes
+    // The parents of the returned roots are left for the caller to fix
+    [[nodiscard]] std::pair<node *, node *> split_at(node *t, size_type k) {
+        if (t == nullptr) {
+            return {nullptr, nullptr};
+        }
+        if (subtree_size(t->left) < k) {
+            const auto [lhs, rhs] = split_at(t->right, k - subtree_size(t->left) - 1);
+            assign_and_keep(t->right, lhs, t);
+            update_node(t);
+            return {t, rhs};
+        }
+        const auto [lhs, rhs] = split_at(t->left, k);
+        assign_and_keep(t->left, rhs, t);
+        update_node(t);
+        return {lhs, t};
+    }
+
+    // Auxiliary operation: Time complexity O(log n)
+    // Splits the subtree at t into the elements less than key and the rest,
+    // and returns their roots
+    // The parents of the returned roots are left for the caller to fix
+    [[nodiscard]] std::pair<node *, node *> split(node *t, const Key &key) {
+        if (t == nullptr) {
+            return {nullptr, nullptr};
+        }
+        if (this->less(t->key(), key)) {
+            const auto [lhs, rhs] = split(t->right, key);
+            assign_and_keep(t->right, lhs, t);
+            update_node(t);
+            return {t, rhs};
+        }
+        const auto [lhs, rhs] = split(t->left, key);
+        assign_and_keep(t->left, rhs, t);
+        update_node(t);
+        return {lhs, t};
+    }
+
+    // Links nodes, which are in key order, into a treap and returns its root
+    // The right spine lives on a stack, so this runs in O(n) without comparing keys
+    // A node's subtree is complete once it leaves the spine
+    [[nodiscard]] node *relink(const std::vector<node *> &nodes) {
+        std::vector<node *> spine;
+        for (node *n : nodes) {
+            node *last = nullptr;
+            while (!spine.empty() && spine.back()->pri < n->pri) {
+                last = spine.back();
+                spine.pop_back();
+                update_node(last);
+            }
+            n->left = last;
+            n->right = nullptr;
+            if (last != nullptr) {
+                last->par = n;
+            }
+            if (!spine.empty()) {
+                spine.back()->right = n;
+                n->par = spine.back();
+            }
+            spine.push_back(n);
+        }
+        for (auto it = spine.rbegin(); it != spine.rend(); ++it) {
+            update_node(*it);
+        }
+        return spine.front();
+    }
+
+    // Nodes of a batch whose keys turned out to be in the tree already, to be
+    // freed once the union is done
+    struct duplicate_list {
+        void add(node *n) {
+            std::lock_guard<std::mutex> lock(mutex);
+            nodes.push_back(n);
+        }
+
+        std::mutex mutex;
+        std::vector<node *> nodes;
+    };
+
+    // Union of the treap at tree and the treap at batch, whose root is
+    // whichever has the higher priority. The other one is split around its
+    // key and the two sides are unioned with its subtrees, the left one on
+    // another thread while the estimated size is above grain
+    // When both have a key, the node from tree stays and the one from batch
+    // goes into duplicates
+    // The parent of the returned root is left for the caller to fix
+    [[nodiscard]] node *unite(node *tree, node *batch, size_type estimate, size_type grain, thread_pool &pool,
+                              duplicate_list &duplicates) {
+        if (tree == nullptr || batch == nullptr) {
+            return tree != nullptr ? tree : batch;
+        }
+        node *root;
+        node *tree_left;
+        node *tree_right;
+        node *batch_left;
+        node *batch_right;
+        if (tree->pri >= batch->pri) {
+            node *same;
+            std::tie(batch_left, same, batch_right) = split3(batch, tree->key());
+            if (same != nullptr) {
+                duplicates.add(same);
+            }
+            root = tree;
+            tree_left = tree->left;
+            tree_right = tree->right;
+        } else {
+            node *same;
+            std::tie(tree_left, same, tree_right) = split3(tree, batch->key());
+            batch_left = batch->left;
+            batch_right = batch->right;
+            if (same != nullptr) {
+                // The element in the tree takes the place of the new one
+                same->pri = batch->pri;
+                batch->left = nullptr;
+                batch->right = nullptr;
+                duplicates.add(batch);
+                root = same;
+            } else {
+                root = batch;
+            }
+        }
+        node *left;
+        node *right;
+        if (estimate > grain) {
+            impl::task_group group(pool);
+            group.spawn([&, tree_left, batch_left] {
+                left = unite(tree_left, batch_left, estimate / 2, grain, pool, duplicates);
+            });
+            right = unite(tree_right, batch_right, estimate / 2, grain, pool, duplicates);
+            group.wait();
+        } else {
+            left = unite(tree_left, batch_left, estimate / 2, grain, pool, duplicates);
+            right = unite(tree_right, batch_right, estimate / 2, grain, pool, duplicates);
+        }
+        assign_and_keep(root->left, left, root);
+        assign_and_keep(root->right, right, root);
+        update_node(root);
+        return root;
+    }
+
+    // Splits the subtree at t into the keys less than key, the node with key
+    // (without its children) if there is one and the keys greater than key
+    // Comparisons aren't counted, as unite() splits on several threads at once
+    // The parents of the returned roots are left for the caller to fix
+    [[nodiscard]] std::tuple<node *, node *, node *> split3(node *t, const Key &key) {
+        if (t == nullptr) {
+            return {nullptr, nullptr, nullptr};
+        }
+        if (this->uncounted_less(t->key(), key)) {
+            const auto [lhs, same, rhs] = split3(t->right, key);
+            assign_and_keep(t->right, lhs, t);
+            update_node(t);
+            return {t, same, rhs};
+        }
+        if (this->uncounted_less(key, t->key())) {
+            const auto [lhs, same, rhs] = split3(t->left, key);
+            assign_and_keep(t->left, rhs, t);
+            update_node(t);
+            return {lhs, same, t};
+        }
+        node *const lhs = std::exchange(t->left, nullptr);
+        node *const rhs = std::exchange(t->right, nullptr);
+        return {lhs, t, rhs};
+    }
+
+    // Auxiliary operation: Time complexity O(log n)
+    // Requires all keys in lhs <= all keys in rhs
+    // If we call split() and get (ll, rr), calling
+    // merge(ll, rr) is guaranteed to meet this condition
+    [[nodiscard]] node *merge(node *lhs, node *rhs, std::uint64_t depth = 1) {
+        this->tally(&tree_stats::merge_steps);
+        this->tally_max(&tree_stats::max_merge_depth, depth);
+        if (lhs == nullptr || rhs == nullptr) {
+            return lhs != nullptr ? lhs : rhs;
+        }
+        assert(lhs->left == nullptr || lhs->left->par == lhs);
+        assert(lhs->right == nullptr || lhs->right->par == lhs);
+        assert(rhs->left == nullptr || rhs->left->par == rhs);
+        assert(rhs->right == nullptr || rhs->right->par == rhs);
+        // lhs has to be subtree of rhs
+        // Merge lhs and rhs->left to form new rhs->left
+        // Return new root rhs
+        // Don't use Compare because we always use our own priorities and < operator
+        if (lhs->pri < rhs->pri) {
+            assign_and_keep(rhs->left, merge(lhs, rhs->left, depth + 1), rhs);
+            update_node(rhs);
+            return rhs;
+        }
+        // rhs has to be subtree of lhs
+        // Merge lhs->right and rhs to form new lhs->right
+        // Return new root lhs
+        assign_and_keep(lhs->right, merge(lhs->right, rhs, depth + 1), lhs);
+        update_node(lhs);
+        return lhs;
+    }
+
+    static constexpr bool top_down = TopDown && !Multi && !Interval && !Prioritized;
+
+    // Assumes that pos really points to the position right after where value is to be inserted
+    // Top-down treaps don't need pos, as they go down from the root anyway
+    [[nodiscard]] iterator insert_(const_iterator pos, const value_type &value) {
+        if constexpr (top_down) {
+            return insert_top_down(value, false).first;
+        }
+        // Make new node from value_type
+        node *node_ = this->create_node(value, nullptr);
+        node_->pri = new_priority();
+        if constexpr (use_key_prefix<Key, Compare>) {
+            node_->prefix = key_prefix(node_->key());
+        }
+
+        iterator it{node_};
+        this->link_leaf(pos, it.node);
+        update_path(it.node);
+        sift_up(it.node);
+
+        return it;
+    }
+
+    // Inserts value where its priority puts it in a single pass from the root,
+    // without any rotation. With check, an element with an equivalent key is
+    // looked for on the way and returned instead if there is one
+    std::pair<iterator, bool> insert_top_down(const value_type &value, bool check) {
+        const Key &key = this->key_of(value);
+        const std::uint64_t prefix = this->prefix_of(key);
+        const priority pri = new_priority();
+        node *par = &header;
+        node **link = &header.par;
+        bool leftmost = true;
+        bool rightmost = true;
+        // Go down past every node that outranks the new one
+        node *n = header.par;
+        for (; n != nullptr && pri <= n->pri; n = *link) {
+            this->tally(&tree_stats::nodes_visited);
+            const int order = direction(key, prefix, n);
+            if (order == 0) {
+                assert(check);
+                return {iterator{n}, false};
+            }
+            par = n;
+            link = order < 0 ? &n->left : &n->right;
+            (order < 0 ? rightmost : leftmost) = false;
+        }
+        // The rest of the path, which the split will take, could still hold key
+        if (check) {
+            for (node *m = n; m != nullptr; ) {
+                this->tally(&tree_stats::nodes_visited);
+                const int order = direction(key, prefix, m);
+                if (order == 0) {
+                    return {iterator{m}, false};
+                }
+                m = order < 0 ? m->left : m->right;
+            }
+        }
+        node *const res = this->create_node(value, par);
+        res->pri = pri;
+        if constexpr (use_key_prefix<Key, Compare>) {
+            res->prefix = prefix;
+        }
+        *link = res;
+        split_into(n, key, prefix, res);
+        if (leftmost && res->left == nullptr) {
+            header.left = res;
+        }
+        if (rightmost && res->right == nullptr) {
+            header.right = res;
+        }
+        return {iterator{res}, true};
+    }
+
+    // Sign of key compared with n->key(), with one call to a three-way
+    // comparator or up to two to an ordinary one
+    [[nodiscard]] int direction(const Key &key, std::uint64_t prefix, const node *n) {
+        if constexpr (base::three_way) {
+            return this->order_of(key, prefix, n);
+        } else {
+            if (this->less_node(key, prefix, n)) {
+                return -1;
+            }
+            return this->node_less(n, key, prefix) ? 1 : 0;
+        }
+    }
+
+    // Splits the subtree at t, which holds no key equivalent to key, straight
+    // into the children of x: the keys less than key go left, the rest right
+    // Iterative: the loose ends of both halves are kept as links to fill in
+    void split_into(node *t, const Key &key, std::uint64_t prefix, node *x) {
+        node **lhs = &x->left;
+        node **rhs = &x->right;
+        node *lhs_par = x;
+        node *rhs_par = x;
+        while (t != nullptr) {
+            if (this->node_less(t, key, prefix)) {
+                *lhs = t;
+                t->par = lhs_par;
+                lhs_par = t;
+                lhs = &t->right;
+                t = t->right;
+            } else {
+                *rhs = t;
+                t->par = rhs_par;
+                rhs_par = t;
+                rhs = &t->left;
+                t = t->left;
+            }
+        }
+        *lhs = nullptr;
+        *rhs = nullptr;
+    }
+
+    // Merge left and right of pos's node and replace pos's node with the result
+    [[nodiscard]] iterator erase_(iterator pos) {
+        assert(pos != this->end());
+        iterator next_it = std::next(pos); // Gets iterator to element with next biggest key
+
+        // Update begin() and rightmost()
+        this->unlink_bounds(pos, next_it);
+
+        node *const par = pos.node->par;
+        assign_and_destroy(pos.node, merge(pos.node->left, pos.node->right), par);
+        update_path(par);
+
+        return next_it;
+    }
+
+    // Replaces dst with src, taking care of dangling pointers
+    // Does not delete the node pointed to by dst
+    // Pass par if dst may be nullptr
+    void assign_and_keep(node *&dst, node *src, node *par) {
+        assert(dst != &header);
+        assert(dst != par);
+        assert(src != par);
+        assert(par != nullptr);
+        if (par == &header) {
+            if (header.par != dst) {
+                assert(false);
+            }
+            assert(header.par == dst);
+        } else {
+            assert(par->left == dst || par->right == dst);
+        }
+
+        // Should not be the root node!
+        if (dst == nullptr) {
+            dst = src;
+            assert(par != nullptr);
+            if (dst != nullptr) {
+                dst->par = par;
+            }
+            return;
+        }
+
+        // Special root node treatment
+        if (par == &header) {
+            dst = src;
+            if (dst != nullptr) {
+                dst->par = &header;
+            }
+            header.par = dst;
+            return;
+        }
+
+        // Backup
+        const bool is_left_child = par->left == dst;
+
+        // Assign
+        dst = src;
+
+        // Fix par's child
+        is_left_child ? par->left = dst : par->right = dst;
+
+        // Fix new dst's par
+        // May be nullptr if src is nullptr; in that case, only par's child is updated
+        if (dst != nullptr) {
+            dst->par = par;
+        }
+
+        assert(dst == nullptr || dst->par == par);
+        assert(par->left == dst || par->right == dst);
+    }
+
+    // Replaces dst with src, taking care of dangling pointers
+    // Also destroys the node pointed to by dst
+    // Requires that dst points to a valid node
+    void assign_and_destroy(node *&dst, node *src, node *par) {
+        assert(dst != &header);
+        assert(dst != nullptr);
+        assert(par != nullptr);
+        // Backup
+        node *const dst_old = dst;
+        assign_and_keep(dst, src, par);
+        // Prevent transferred children from being destroyed
+        this->destroy_unlinked(dst_old);
+    }
+
+    void swap_balance(treap &other) noexcept {
+        std::swap(decay_debt_, other.decay_debt_);
+        std::swap(decay_next_, other.decay_next_);
+        std::swap(decay_period_, other.decay_period_);
+    }
+
+    // The decay period is a setting rather than state, so it stays
+    void reset_balance() noexcept {
+        decay_debt_ = 0;
+        decay_next_.reset();
+    }
+
+    // Agings owed by lookups, times decay_period(), and where the last ones
+    // stopped (adaptive treaps only)
+    size_type decay_debt_{};
+    std::optional<std::conditional_t<Adaptive, Key, null_type>> decay_next_;
+    size_type decay_period_{};
+
+    inline static std::minstd_rand generator{}; // NOLINT(cert-msc51-cpp)
+};
+
+struct avl_balance {
+    int height{1};
+};
+
+template<class Key, class T>
+struct avl_node : node_base<Key, T, avl_node<Key, T>, avl_balance> {
+    using node_base<Key, T, avl_node, avl_balance>::node_base;
+};
+
+// Height-balanced: the heights of the two subtrees of any node differ by at
+// most 1, so the tree height is at most ~1.44 log2(n)
+template<class Key, class T, class Compare, class Allocator>
+class avl_tree : public bst_base<Key, T, Compare, Allocator, avl_node<Key, T>, avl_tree<Key, T, Compare, Allocator>> {
+private:
+    using base = bst_base<Key, T, Compare, Allocator, avl_node<Key, T>, avl_tree>;
+    friend base;
+
+    using typename base::node;
+    using base::header;
+
+public:
+    using typename base::value_type;
+    using typename base::size_type;
+    using typename base::iterator;
+    using typename base::const_iterator;
+
+    using base::base;
+
+private:
+    [[nodiscard]] static int height(const node *n) {
+        return n != nullptr ? n->height : 0;
+    }
+
+    static void update_height(node *n) {
+        n->height = std::max(height(n->left), height(n->right)) + 1;
+    }
+
+    // Rotates child above its parent and returns it
+    node *rotate_up(node *child) {
+        node *const par = child->par;
+        if (par->left == child) {
+            this->rotate_right(par, child);
+        } else {
+            assert(par->right == child);
+            this->rotate_left(par, child);
+        }
+        update_height(par);
+        update_height(child);
+        return child;
+    }
+
+    // Walks up from n fixing heights and rotating where the balance is off
+    // Stops once a subtree keeps its old height, as nothing above it changes
+    void rebalance(node *n) {
+        while (n != &header) {
+            const int old_height = n->height;
+            const int balance = height(n->left) - height(n->right);
+            if (balance > 1) {
+                node *child = n->left;
+                if (height(child->left) < height(child->right)) {
+                    rotate_up(child->right);
+                    child = n->left;
+                }
+                n = rotate_up(child);
+            } else if (balance < -1) {
+                node *child = n->right;
+                if (height(child->right) < height(child->left)) {
+                    rotate_up(child->left);
+                    child = n->right;
+                }
+                n = rotate_up(child);
+            } else {
+                update_height(n);
+            }
+            if (n->height == old_height) {
+                break;
+            }
+            n = n->par;
+        }
+    }
+
+    [[nodiscard]] iterator insert_(const_iterator pos, const value_type &value) {
+        node *node_ = this->create_node(value, nullptr);
+        this->link_leaf(pos, node_);
+        rebalance(node_->par);
+        return iterator{node_};
+    }
+
+    // Nodes with two children are replaced by their successor so that
+    // iterators to every other element stay valid
+    [[nodiscard]] iterator erase_(iterator pos) {
+        assert(pos != this->end());
+        iterator next_it = std::next(pos);
+        this->unlink_bounds(pos, next_it);
+
+        node *const z = pos.node;
+        node *const fix_from = this->unlink(z, next_it.node);
+        if (z->left != nullptr && z->right != nullptr) {
+            // The successor took over z's place, and with it z's old height
+            next_it.node->height = z->height;
+        }
+
+        this->destroy_unlinked(z);
+        rebalance(fix_from);
+
+        return next_it;
+    }
+};
+
+struct rb_balance {
+    bool red{true};
+};
+
+template<class Key, class T>
+struct rb_node : node_base<Key, T, rb_node<Key, T>, rb_balance> {
+    using node_base<Key, T, rb_node, rb_balance>::node_base;
+};
+
+// Red-black tree: no red node has a red child and every root-to-leaf path
+// has the same number of black nodes, so the tree height is at most 2 log2(n)
+// Needs fewer rotations per update than the AVL tree at the cost of depth
+template<class Key, class T, class Compare, class Allocator>
+class rb_tree : public bst_base<Key, T, Compare, Allocator, rb_node<Key, T>, rb_tree<Key, T, Compare, Allocator>> {
+private:
+    using base = bst_base<Key, T, Compare, Allocator, rb_node<Key, T>, rb_tree>;
+    friend base;
+
+    using typename base::node;
+    using base::root;
+
+public:
+    using typename base::value_type;
+    using typename base::size_type;
+    using typename base::iterator;
+    using typename base::const_iterator;
+
+    using base::base;
+
+private:
+    // Null leaves count as black
+    [[nodiscard]] static bool is_red(const node *n) {
+        return n != nullptr && n->red;
+    }
+
+    [[nodiscard]] iterator insert_(const_iterator pos, const value_type &value) {
+        node *node_ = this->create_node(value, nullptr);
+        this->link_leaf(pos, node_);
+        insert_fixup(node_);
+        return iterator{node_};
+    }
+
+    void insert_fixup(node *x) {
+        while (x != root() && x->par->red) {
+            node *par = x->par;
+            node *const grandpar = par->par; // Exists as the root is black
+            if (par == grandpar->left) {
+                node *const uncle = grandpar->right;
+                if (is_red(uncle)) {
+                    par->red = false;
+                    uncle->red = false;
+                    grandpar->red = true;
+                    x = grandpar;
+                    continue;
+                }
+                if (x == par->right) {
+                    this->rotate_left(par, x);
+                    std::swap(x, par);
+                }
+                par->red = false;
+                grandpar->red = true;
+                this->rotate_right(grandpar, par);
+            } else {
+                node *const uncle = grandpar->left;
+                if (is_red(uncle)) {
+                    par->red = false;
+                    uncle->red = false;
+                    grandpar->red = true;
+                    x = grandpar;
+                    continue;
+                }
+                if (x == par->left) {
+                    this->rotate_right(par, x);
+                    std::swap(x, par);
+                }
+                par->red = false;
+                grandpar->red = true;
+                this->rotate_left(grandpar, par);
+            }
+        }
+        root()->red = false;
+    }
+
+    // Nodes with two children are replaced by their successor so that
+    // iterators to every other element stay valid
+    [[nodiscard]] iterator erase_(iterator pos) {
+        assert(pos != this->end());
+        iterator next_it = std::next(pos);
+        this->unlink_bounds(pos, next_it);
+
+        node *const z = pos.node;
+        node *x;     // Takes the place of the removed black node, may be nullptr
+        node *x_par; // So we know where x is when it is nullptr
+        bool removed_red;
+        if (z->left != nullptr && z->right != nullptr) {
+            node *const y = next_it.node;
+            assert(y->left == nullptr);
+            removed_red = y->red;
+            x = y->right;
+            if (y->par != z) {
+                x_par = y->par;
+                this->transplant(y, y->right);
+                y->right = z->right;
+                y->right->par = y;
+            } else {
+                x_par = y;
+            }
+            this->transplant(z, y);
+            y->left = z->left;
+            y->left->par = y;
+            y->red = z->red;
+        } else {
+            removed_red = z->red;
+            x = z->left != nullptr ? z->left : z->right;
+            x_par = z->par;
+            this->transplant(z, x);
+        }
+
+        this->destroy_unlinked(z);
+        if (!removed_red) {
+            erase_fixup(x, x_par);
+        }
+
+        return next_it;
+    }
+
+    // x carries an extra black; push it up until it can be absorbed
+    void erase_fixup(node *x, node *x_par) {
+        while (x != root() && !is_red(x)) {
+            if (x == x_par->left) {
+                node *sibling = x_par->right;
+                if (sibling->red) {
+                    sibling->red = false;
+                    x_par->red = true;
+                    this->rotate_left(x_par, sibling);
+                    sibling = x_par->right;
+                }
+                if (!is_red(sibling->left) && !is_red(sibling->right)) {
+                    sibling->red = true;
+                    x = x_par;
+                    x_par = x_par->par;
+                    continue;
+                }
+                if (!is_red(sibling->right)) {
+                    sibling->left->red = false;
+                    sibling->red = true;
+                    this->rotate_right(sibling, sibling->left);
+                    sibling = x_par->right;
+                }
+                sibling->red = x_par->red;
+                x_par->red = false;
+                sibling->right->red = false;
+                this->rotate_left(x_par, sibling);
+            } else {
+                node *sibling = x_par->left;
+                if (sibling->red) {
+                    sibling->red = false;
+                    x_par->red = true;
+                    this->rotate_right(x_par, sibling);
+                    sibling = x_par->left;
+                }
+                if (!is_red(sibling->left) && !is_red(sibling->right)) {
+                    sibling->red = true;
+                    x = x_par;
+                    x_par = x_par->par;
+                    continue;
+                }
+                if (!is_red(sibling->left)) {
+                    sibling->right->red = false;
+                    sibling->red = true;
+                    this->rotate_left(sibling, sibling->right);
+                    sibling = x_par->left;
+                }
+                sibling->red = x_par->red;
+                x_par->red = false;
+                sibling->left->red = false;
+                this->rotate_right(x_par, sibling);
+            }
+            x = root();
+        }
+        if (x != nullptr) {
+            x->red = false;
+        }
+    }
+};
+
+template<class Key, class T>
+struct scapegoat_node : node_base<Key, T, scapegoat_node<Key, T>> {
+    using node_base<Key, T, scapegoat_node>::node_base;
+};
+
+// Scapegoat tree (as in Open Data Structures, with alpha = 2/3): nodes carry no
+// balancing data at all and no random numbers are drawn
+// When an insert ends up deeper than log_{3/2}(size_bound_), the lowest
+// ancestor with a child holding more than 2/3 of its subtree is rebuilt into a
+// perfectly balanced subtree, and the whole tree is rebuilt once erases have
+// halved it. Both cost amortised O(log n) per update
+template<class Key, class T, class Compare, class Allocator>
+class scapegoat_tree : public bst_base<Key, T, Compare, Allocator, scapegoat_node<Key, T>, scapegoat_tree<Key, T, Compare, Allocator>> {
+private:
+    using base = bst_base<Key, T, Compare, Allocator, scapegoat_node<Key, T>, scapegoat_tree>;
+    friend base;
+
+    using typename base::node;
+    using base::header;
+    using base::root;
+
+public:
+    using typename base::value_type;
+    using typename base::size_type;
+    using typename base::iterator;
+    using typename base::const_iterator;
+
+    using base::base;
+
+private:
+    static_assert(sizeof(node) == sizeof(node_base<Key, T, node>));
+
+    [[nodiscard]] static size_type subtree_size(const node *n) {
+        return n == nullptr ? 0 : subtree_size(n->left) + 1 + subtree_size(n->right);
+    }
+
+    // floor(log_{3/2}(n))
+    [[nodiscard]] static int depth_limit(size_type n) {
+        return static_cast<int>(std::log(static_cast<double>(n)) / std::log(1.5));
+    }
+
+    [[nodiscard]] iterator insert_(const_iterator pos, const value_type &value) {
+        node *node_ = this->create_node(value, nullptr);
+        this->link_leaf(pos, node_);
+        size_bound_++;
+
+        int depth = 0;
+        for (const node *n = node_; n->par != &header; n = n->par) {
+            depth++;
+        }
+        if (depth > depth_limit(size_bound_)) {
+            // Some ancestor has to be unbalanced, otherwise node_ could not be this deep
+            node *child = node_;
+            size_type child_size = 1;
+            while (true) {
+                node *const par = child->par;
+                assert(par != &header);
+                const size_type par_size = child_size + 1 + subtree_size(par->left == child ? par->right : par->left);
+                if (3 * child_size > 2 * par_size) {
+                    rebuild(par, par_size);
+                    break;
+                }
+                child = par;
+                child_size = par_size;
+            }
+        }
+        return iterator{node_};
+    }
+
+    [[nodiscard]] iterator erase_(iterator pos) {
+        assert(pos != this->end());
+        iterator next_it = std::next(pos);
+        this->unlink_bounds(pos, next_it);
+
+        std::ignore = this->unlink(pos.node, next_it.node);
+        this->destroy_unlinked(pos.node);
+
+        if (2 * this->size() < size_bound_) {
+            if (root() != nullptr) {
+                rebuild(root(), this->size());
+            }
+            size_bound_ = this->size();
+        }
+
+        return next_it;
+    }
+
+    // Replaces the subtree at n, which holds count nodes, with a perfectly
+    // balanced one made of the same nodes. O(count)
+    void rebuild(node *n, size_type count) {
+        node *const par = n->par;
+        std::vector<node *> nodes;
+        nodes.reserve(count);
+        flatten(n, nodes);
+        assert(nodes.size() == count);
+        node *const top = build(nodes, 0, nodes.size());
+        if (par == &header) {
+            header.par = top;
+        } else if (par->left == n) {
+            par->left = top;
+        } else {
+            par->right = top;
+        }
+        top->par = par;
+    }
+
+    static void flatten(node *n, std::vector<node *> &out) {
+        if (n == nullptr) {
+            return;
+        }
+        flatten(n->left, out);
+        out.push_back(n);
+        flatten(n->right, out);
+    }
+
+    // Links nodes[lo, hi) into a balanced subtree and returns its root
+    [[nodiscard]] static node *build(const std::vector<node *> &nodes, size_type lo, size_type hi) {
+        if (lo == hi) {
+            return nullptr;
+        }
+        const size_type mid = lo + (hi - lo) / 2;
+        node *const n = nodes[mid];
+        n->left = build(nodes, lo, mid);
+        n->right = build(nodes, mid + 1, hi);
+        if (n->left != nullptr) {
+            n->left->par = n;
+        }
+        if (n->right != nullptr) {
+            n->right->par = n;
+        }
+        return n;
+    }
+
+    void swap_balance(scapegoat_tree &other) noexcept {
+        std::swap(size_bound_, other.size_bound_);
+    }
+
+    void reset_balance() noexcept {
+        size_bound_ = 0;
+    }
+
+    // Upper bound on size(), reset to size() whenever the whole tree is rebuilt
+    size_type size_bound_{};
+};
+
+}
+
+// Pick the backend behind bst::set and bst::map with -DBST_IMPL=...
+// All of them are also available by name below, e.g. bst::avl_map
+#define BST_TREAP 0
+#define BST_AVL 1
+#define BST_RED_BLACK 2
+#define BST_SCAPEGOAT 3
+
+#ifndef BST_IMPL
+#define BST_IMPL BST_TREAP
+#endif
+
+template<
+        class Key,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<Key>
+>
+using treap_set = impl::treap<Key, impl::null_type, Compare, Allocator>;
+
+template<
+        class Key,
+        class T,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<std::pair<const Key, T>>
+>
+using treap_map = impl::treap<Key, T, Compare, Allocator>;
+
+// Treaps whose hot keys drift towards the root, for skewed lookups
+template<
+        class Key,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<Key>
+>
+using adaptive_set = impl::treap<Key, impl::null_type, Compare, Allocator, true>;
+
+template<
+        class Key,
+        class T,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<std::pair<const Key, T>>
+>
+using adaptive_map = impl::treap<Key, T, Compare, Allocator, true>;
+
+template<
+        class Key,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<Key>
+>
+using avl_set = impl::avl_tree<Key, impl::null_type, Compare, Allocator>;
+
+template<
+        class Key,
+        class T,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<std::pair<const Key, T>>
+>
+using avl_map = impl::avl_tree<Key, T, Compare, Allocator>;
+
+template<
+        class Key,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<Key>
+>
+using rb_set = impl::rb_tree<Key, impl::null_type, Compare, Allocator>;
+
+template<
+        class Key,
+        class T,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<std::pair<const Key, T>>
+>
+using rb_map = impl::rb_tree<Key, T, Compare, Allocator>;
+
+template<
+        class Key,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<Key>
+>
+using scapegoat_set = impl::scapegoat_tree<Key, impl::null_type, Compare, Allocator>;
+
+template<
+        class Key,
+        class T,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<std::pair<const Key, T>>
+>
+using scapegoat_map = impl::scapegoat_tree<Key, T, Compare, Allocator>;
+
+#if BST_IMPL == BST_TREAP
+template<class Key, class Compare = std::less<Key>, class Allocator = std::allocator<Key>>
+using set = treap_set<Key, Compare, Allocator>;
+
+template<class Key, class T, class Compare = std::less<Key>, class Allocator = std::allocator<std::pair<const Key, T>>>
+using map = treap_map<Key, T, Compare, Allocator>;
+#elif BST_IMPL == BST_AVL
+template<class Key, class Compare = std::less<Key>, class Allocator = std::allocator<Key>>
+using set = avl_set<Key, Compare, Allocator>;
+
+template<class Key, class T, class Compare = std::less<Key>, class Allocator = std::allocator<std::pair<const Key, T>>>
+using map = avl_map<Key, T, Compare, Allocator>;
+#elif BST_IMPL == BST_RED_BLACK
+template<class Key, class Compare = std::less<Key>, class Allocator = std::allocator<Key>>
+using set = rb_set<Key, Compare, Allocator>;
+
+template<class Key, class T, class Compare = std::less<Key>, class Allocator = std::allocator<std::pair<const Key, T>>>
+using map = rb_map<Key, T, Compare, Allocator>;
+#elif BST_IMPL == BST_SCAPEGOAT
+template<class Key, class Compare = std::less<Key>, class Allocator = std::allocator<Key>>
+using set = scapegoat_set<Key, Compare, Allocator>;
+
+template<class Key, class T, class Compare = std::less<Key>, class Allocator = std::allocator<std::pair<const Key, T>>>
+using map = scapegoat_map<Key, T, Compare, Allocator>;
+#else
+#error "Unknown BST_IMPL"
+#endif
+
+// Duplicate keys are only supported by treaps, whatever BST_IMPL is
+template<
+        class Key,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<Key>
+>
+using multiset = impl::treap<Key, impl::null_type, Compare, Allocator, false, true>;
+
+template<
+        class Key,
+        class T,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<std::pair<const Key, T>>
+>
+using multimap = impl::treap<Key, T, Compare, Allocator, false, true>;
+
+// Closed intervals [start, end] keyed by start, with overlap and stabbing
+// queries, see bst::impl::treap
+template<
+        class Key,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<std::pair<const Key, Key>>
+>
+using interval_map = impl::treap<Key, Key, Compare, Allocator, false, false, false, true>;
+
+// Like interval_map, but several intervals can start at the same point
+template<
+        class Key,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<std::pair<const Key, Key>>
+>
+using interval_multimap = impl::treap<Key, Key, Compare, Allocator, false, true, false, true>;
+
+// Keys mapped to priorities, with the best priority in a range of keys and
+// heap-like pops, see bst::impl::treap
+template<
+        class Key,
+        class Priority,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<std::pair<const Key, Priority>>
+>
+using priority_map = impl::treap<Key, Priority, Compare, Allocator, false, false, false, false, true>;
+
+// Treaps that check a counting Bloom filter before looking a key up, so that
+// most finds of keys that aren't there don't go down the tree
+// Equivalent keys have to hash the same with std::hash
+template<
+        class Key,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<Key>
+>
+using filtered_set = impl::treap<Key, impl::null_type, Compare, Allocator, false, false,
+                                 BST_TREAP_INSERT == BST_TOP_DOWN, false, false, true>;
+
+template<
+        class Key,
+        class T,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<std::pair<const Key, T>>
+>
+using filtered_map = impl::treap<Key, T, Compare, Allocator, false, false, BST_TREAP_INSERT == BST_TOP_DOWN, false,
+                                 false, true>;
+
+// Treap map with a hash table from keys to nodes on the side, so that find(),
+// erase(key) and operator[] on a key already there take O(1) expected, while
+// ordered operations go through the tree as usual
+// Equivalent keys have to hash the same with std::hash
+template<
+        class Key,
+        class T,
+        class Compare   = std::less<Key>,
+        class Allocator = std::allocator<std::pair<const Key, T>>
+>
+using indexed_map = impl::treap<Key, T, Compare, Allocator, false, false, BST_TREAP_INSERT == BST_TOP_DOWN, false,
+                                false, false, true>;
 
 }
 
-// TODO: Splay trees, AVL trees, scapegoat trees
-//  More: Red-black trees, B*-trees
+// TODO: Splay trees
+//  More: B*-trees
 
 #endif //BST_BST_H
@@ -0,0 +1,136 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#ifndef BST_FILTER_H
+#define BST_FILTER_H
+
+#include <cstddef> // std::size_t
+#include <cstdint> // std::uint64_t
+
+#include <functional> // std::hash
+#include <memory>     // std::allocator_traits::rebind_alloc
+#include <vector>     // std::vector
+
+namespace bst::impl {
+
+// Counting Bloom filter over the keys of a tree, which can tell that a key
+// isn't in the tree without going down it
+// Each key sets 4 of the 128 4-bit counters of one 64-byte block, so a
+// lookup reads one block. With 16 keys per block at most, about 1 in 40 keys
+// that aren't there get through
+// Counters stick at 15 rather than overflow, so keys can be removed as long
+// as they were added, and the filter only ever errs on the side of a key
+// being there
+// Equivalent keys have to hash the same with Hash
+template<class Key, class Allocator, class Hash = std::hash<Key>>
+class counting_filter {
+public:
+    static constexpr std::size_t keys_per_block = 16;
+
+    counting_filter() = default;
+
+    explicit counting_filter(const Allocator &alloc) : words(word_allocator(alloc)) {}
+
+    // Number of keys the filter is sized for
+    [[nodiscard]] std::size_t capacity() const noexcept {
+        return words.size() / words_per_block * keys_per_block;
+    }
+
+    [[nodiscard]] std::size_t memory_usage() const noexcept {
+        return words.capacity() * sizeof(std::uint64_t);
+    }
+
+    // Empties the filter and sizes it for keys keys
+    void reset(std::size_t keys) {
+        std::size_t blocks = 1;
+        while (blocks * keys_per_block < keys) {
+            blocks *= 2;
+        }
+        words.assign(blocks * words_per_block, 0);
+    }
+
+    // Drops the counters altogether, leaving a filter with no capacity
+    void clear() noexcept {
+        words.clear();
+        words.shrink_to_fit();
+    }
+
+    // Does nothing without any capacity
+    void add(const Key &key) noexcept {
+        for_each_counter(key, [](std::uint64_t &word, unsigned shift) {
+            if (((word >> shift) & 15) != 15) {
+                word += std::uint64_t{1} << shift;
+            }
+        });
+    }
+
+    // Takes back an add(key)
+    void remove(const Key &key) noexcept {
+        for_each_counter(key, [](std::uint64_t &word, unsigned shift) {
+            if (const std::uint64_t count = (word >> shift) & 15; count != 15 && count != 0) {
+                word -= std::uint64_t{1} << shift;
+            }
+        });
+    }
+
+    // false if key was never added, or removed as many times as it was added
+    [[nodiscard]] bool may_contain(const Key &key) const noexcept {
+        if (words.empty()) {
+            return true;
+        }
+        const std::uint64_t h = hash(key);
+        const std::uint64_t *block = &words[block_of(h) * words_per_block];
+        for (unsigned i = 0; i < counters_per_key; i++) {
+            const unsigned counter = (h >> (counter_bits * i)) & (counters_per_block - 1);
+            if (((block[counter / 16] >> (counter % 16 * 4)) & 15) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    static constexpr std::size_t words_per_block = 8;
+    static constexpr unsigned counters_per_block = 128;
+    static constexpr unsigned counter_bits = 7;
+    static constexpr unsigned counters_per_key = 4;
+
+    using word_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<std::uint64_t>;
+
+    // Scrambles the hash (std::hash of an integer is usually the integer
+    // itself) with the MurmurHash3 finaliser
+    [[nodiscard]] static std::uint64_t hash(const Key &key) noexcept {
+        std::uint64_t h = Hash()(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    // The top bits pick the block and the bottom ones the counters in it
+    [[nodiscard]] std::size_t block_of(std::uint64_t h) const noexcept {
+        return static_cast<std::size_t>(h >> 32) & (words.size() / words_per_block - 1);
+    }
+
+    template<class F>
+    void for_each_counter(const Key &key, F f) noexcept {
+        if (words.empty()) {
+            return;
+        }
+        const std::uint64_t h = hash(key);
+        std::uint64_t *block = &words[block_of(h) * words_per_block];
+        for (unsigned i = 0; i < counters_per_key; i++) {
+            const unsigned counter = (h >> (counter_bits * i)) & (counters_per_block - 1);
+            f(block[counter / 16], counter % 16 * 4);
+        }
+    }
+
+    std::vector<std::uint64_t, word_allocator> words;
+};
+
+}
+
+#endif //BST_FILTER_H
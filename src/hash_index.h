@@ -0,0 +1,153 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#ifndef BST_HASH_INDEX_H
+#define BST_HASH_INDEX_H
+
+#include <cstddef> // std::size_t
+#include <cstdint> // std::uint64_t
+
+#include <functional> // std::hash
+#include <memory>     // std::allocator_traits::rebind_alloc
+#include <vector>     // std::vector
+
+namespace bst::impl {
+
+// Open-addressing hash table from the keys of a tree to its nodes, so that a
+// key can be found without going down the tree
+// Linear probing, with the full hash kept next to each node so that probes
+// only read a node whose key is likely to match, and erase() shifting later
+// entries back instead of leaving tombstones. At most 3/4 full
+// Nodes are told apart by address, so a table can briefly hold two nodes with
+// equivalent keys (e.g. a duplicate about to be freed) and erase the right one
+// Equivalent keys have to hash the same with Hash
+template<class Key, class Node, class Allocator, class Hash = std::hash<Key>>
+class hash_index {
+public:
+    hash_index() = default;
+
+    explicit hash_index(const Allocator &alloc) : slots(slot_allocator(alloc)) {}
+
+    [[nodiscard]] std::size_t size() const noexcept {
+        return count;
+    }
+
+    [[nodiscard]] std::size_t memory_usage() const noexcept {
+        return slots.capacity() * sizeof(slot);
+    }
+
+    // Makes room for keys entries in all, so that as many insert()s can't throw
+    void reserve(std::size_t keys) {
+        std::size_t capacity = slots.empty() ? min_capacity : slots.size();
+        while (keys > capacity / 4 * 3) {
+            capacity *= 2;
+        }
+        if (capacity != slots.size()) {
+            rehash(capacity);
+        }
+    }
+
+    // Returns the node with a key that equal says is key's, or nullptr
+    template<class Equal>
+    [[nodiscard]] Node *find(const Key &key, Equal equal) const {
+        if (slots.empty()) {
+            return nullptr;
+        }
+        const std::size_t h = Hash()(key);
+        for (std::size_t i = home(h);; i = (i + 1) & mask()) {
+            const slot &s = slots[i];
+            if (s.node == nullptr) {
+                return nullptr;
+            }
+            if (s.hash == h && equal(s.node)) {
+                return s.node;
+            }
+        }
+    }
+
+    // Adds n, which there has to be room for, see reserve()
+    void insert(Node *n) noexcept {
+        place(n, Hash()(n->key()));
+        count++;
+    }
+
+    // Takes n out, which has to be in the table
+    void erase(const Node *n) noexcept {
+        std::size_t i = home(Hash()(n->key()));
+        while (slots[i].node != n) {
+            i = (i + 1) & mask();
+        }
+        // Moves back every later entry of the run that may sit in the gap,
+        // i.e. whose home isn't cyclically in (i, j]
+        for (std::size_t j = (i + 1) & mask(); slots[j].node != nullptr; j = (j + 1) & mask()) {
+            const std::size_t k = home(slots[j].hash);
+            if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        slots[i] = slot{};
+        count--;
+    }
+
+    // Empties the table, keeping its room
+    void reset() noexcept {
+        for (slot &s : slots) {
+            s = slot{};
+        }
+        count = 0;
+    }
+
+    // Empties the table and gives its memory back
+    void clear() noexcept {
+        slots.clear();
+        slots.shrink_to_fit();
+        count = 0;
+    }
+
+private:
+    static constexpr std::size_t min_capacity = 16;
+
+    struct slot {
+        Node *node{};
+        std::size_t hash{};
+    };
+
+    using slot_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<slot>;
+
+    [[nodiscard]] std::size_t mask() const noexcept {
+        return slots.size() - 1;
+    }
+
+    // Fibonacci hashing, as std::hash of an integer is usually the integer
+    // itself: the top bits of the product depend on every bit of the hash
+    [[nodiscard]] std::size_t home(std::size_t h) const noexcept {
+        return static_cast<std::size_t>((static_cast<std::uint64_t>(h) * 0x9E3779B97F4A7C15ULL) >> 32) & mask();
+    }
+
+    void place(Node *n, std::size_t h) noexcept {
+        std::size_t i = home(h);
+        while (slots[i].node != nullptr) {
+            i = (i + 1) & mask();
+        }
+        slots[i] = slot{n, h};
+    }
+
+    void rehash(std::size_t capacity) {
+        std::vector<slot, slot_allocator> old(capacity, slot{}, slots.get_allocator());
+        old.swap(slots);
+        for (const slot &s : old) {
+            if (s.node != nullptr) {
+                place(s.node, s.hash);
+            }
+        }
+    }
+
+    std::vector<slot, slot_allocator> slots;
+    std::size_t count{};
+};
+
+}
+
+#endif //BST_HASH_INDEX_H
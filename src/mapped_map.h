@@ -0,0 +1,588 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#ifndef BST_MAPPED_MAP_H
+#define BST_MAPPED_MAP_H
+
+#include <fcntl.h>    // O_CLOEXEC, O_CREAT, O_RDWR, open
+#include <sys/mman.h> // MAP_FAILED, MAP_SHARED, MS_SYNC, PROT_READ, PROT_WRITE, mmap, msync, munmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close, ftruncate
+
+#include <cerrno>  // errno
+#include <cstddef> // std::size_t
+#include <cstdint> // std::uint32_t, std::uint64_t
+#include <cstring> // std::memcmp, std::memcpy
+
+#include <algorithm>    // std::max
+#include <functional>   // std::less
+#include <iterator>     // std::bidirectional_iterator_tag
+#include <new>          // placement new
+#include <random>       // std::minstd_rand
+#include <stdexcept>    // std::runtime_error
+#include <string>       // std::string
+#include <system_error> // std::generic_category, std::system_error
+#include <type_traits>  // std::conditional_t, std::enable_if_t, std::is_trivially_copyable_v
+#include <utility>      // std::exchange, std::pair
+
+namespace bst {
+
+namespace impl {
+
+// Sits at the start of a mapped_map's file, followed by the nodes
+struct mapped_header {
+    static constexpr char MAGIC[8] = {'B', 'S', 'T', 'M', 'A', 'P', '\0', '\0'};
+    static constexpr std::uint32_t VERSION = 1;
+    static constexpr std::uint32_t ORDER_MARK = 0x01020304;
+
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t order_mark;
+    std::uint32_t key_size;
+    std::uint32_t mapped_size;
+    std::uint32_t node_size;
+    std::uint32_t reserved;
+    std::uint64_t root;
+    std::uint64_t leftmost;
+    std::uint64_t rightmost;
+    std::uint64_t size;
+    std::uint64_t free_list; // Erased nodes, chained through left
+    std::uint64_t used;      // Bytes handed out so far, header included
+};
+
+[[noreturn]] inline void throw_errno(const char *what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+}
+
+// A treap map whose nodes live in a file mapped into memory, so that it
+// survives restarts and can be bigger than we want on the heap
+// Opening a map only maps the file: nodes are paged in as they are touched
+// and the OS page cache decides what stays resident
+// Links are offsets from the start of the file instead of pointers, so the
+// file can be mapped anywhere. Key and T have to be trivially copyable and
+// are stored as they are in memory, so the file is only portable between
+// builds with the same layout. Only one mapped_map should have a file open
+// at a time
+// The file grows (by doubling) as elements are added and is remapped when it
+// does: iterators stay valid, but pointers and references to elements don't
+// Erased nodes are reused, but the file never shrinks
+template<class Key, class T, class Compare = std::less<Key>>
+class mapped_map {
+    static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<T>,
+                  "mapped_map stores keys and values as they are in memory");
+
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<const Key, T>;
+    using size_type = std::size_t;
+    using key_compare = Compare;
+
+private:
+    // 0 is the file header, so it can stand for null
+    using offset = std::uint64_t;
+    using priority = std::uint32_t;
+
+    static constexpr offset NIL = 0;
+
+    struct node {
+        value_type record;
+        offset     left;
+        offset     right;
+        offset     par; // NIL at the root
+        priority   pri;
+    };
+
+    static constexpr offset FIRST_NODE = (sizeof(impl::mapped_header) + alignof(node) - 1) / alignof(node)
+                                         * alignof(node);
+
+public:
+    // Bidirectional iterator holding an offset, so it survives the file being
+    // remapped
+    template<bool Const>
+    class iter {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = typename mapped_map::value_type;
+        using pointer = std::conditional_t<Const, const value_type *, value_type *>;
+        using reference = std::conditional_t<Const, const value_type &, value_type &>;
+
+        iter() = default;
+
+        template<bool C = Const, std::enable_if_t<C, bool> = true>
+        iter(const iter<false> &other) : map(other.map), off(other.off) {} // NOLINT(google-explicit-constructor)
+
+        reference operator*() const {
+            return map->ptr(off)->record;
+        }
+
+        pointer operator->() const {
+            return &map->ptr(off)->record;
+        }
+
+        iter &operator++() {
+            off = map->successor(off);
+            return *this;
+        }
+
+        iter operator++(int) {
+            iter res = *this;
+            ++*this;
+            return res;
+        }
+
+        // --end() is the rightmost element
+        iter &operator--() {
+            off = off == NIL ? map->head().rightmost : map->predecessor(off);
+            return *this;
+        }
+
+        iter operator--(int) {
+            iter res = *this;
+            --*this;
+            return res;
+        }
+
+        friend bool operator==(const iter &lhs, const iter &rhs) {
+            return lhs.off == rhs.off;
+        }
+
+        friend bool operator!=(const iter &lhs, const iter &rhs) {
+            return lhs.off != rhs.off;
+        }
+
+    private:
+        friend mapped_map;
+        friend class iter<!Const>;
+
+        using map_pointer = std::conditional_t<Const, const mapped_map *, mapped_map *>;
+
+        iter(map_pointer map, offset off) : map(map), off(off) {}
+
+        map_pointer map{};
+        offset off{};
+    };
+
+    using iterator = iter<false>;
+    using const_iterator = iter<true>;
+
+    // Opens the map in the file at path, creating it if it doesn't exist
+    // A new file starts out with room for initial_bytes
+    // Throws std::system_error if the file can't be opened or mapped, and
+    // std::runtime_error if it holds something other than this kind of map
+    explicit mapped_map(const std::string &path, size_type initial_bytes = size_type{1} << 20,
+                        const Compare &comp = Compare())
+            : comp(comp) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            impl::throw_errno("bst: could not open mapped_map file");
+        }
+        try {
+            struct stat st {};
+            if (::fstat(fd, &st) != 0) {
+                impl::throw_errno("bst: could not stat mapped_map file");
+            }
+            if (st.st_size == 0) {
+                create(std::max<size_type>(initial_bytes, FIRST_NODE + sizeof(node)));
+            } else {
+                open_existing(static_cast<size_type>(st.st_size));
+            }
+        } catch (...) {
+            release();
+            throw;
+        }
+    }
+
+    mapped_map(const mapped_map &) = delete;
+    mapped_map &operator=(const mapped_map &) = delete;
+
+    mapped_map(mapped_map &&other) noexcept
+            : comp(other.comp),
+              fd(std::exchange(other.fd, -1)),
+              base(std::exchange(other.base, nullptr)),
+              capacity(std::exchange(other.capacity, 0)) {}
+
+    mapped_map &operator=(mapped_map &&other) noexcept {
+        if (this != &other) {
+            release();
+            comp = other.comp;
+            fd = std::exchange(other.fd, -1);
+            base = std::exchange(other.base, nullptr);
+            capacity = std::exchange(other.capacity, 0);
+        }
+        return *this;
+    }
+
+    // Unmaps the file, leaving what hasn't been written back yet to the OS
+    // Call flush() first to be sure it is on disk
+    ~mapped_map() {
+        release();
+    }
+
+    // Writes every change back to the file and waits for it to be done
+    void flush() {
+        if (::msync(base, capacity, MS_SYNC) != 0) {
+            impl::throw_errno("bst: could not flush mapped_map");
+        }
+    }
+
+    [[nodiscard]] size_type size() const noexcept {
+        return head().size;
+    }
+
+    [[nodiscard]] bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    // Size of the file
+    [[nodiscard]] size_type file_size() const noexcept {
+        return capacity;
+    }
+
+    [[nodiscard]] key_compare key_comp() const {
+        return comp;
+    }
+
+    [[nodiscard]] iterator begin() noexcept {
+        return iterator{this, head().leftmost};
+    }
+
+    [[nodiscard]] const_iterator begin() const noexcept {
+        return const_iterator{this, head().leftmost};
+    }
+
+    [[nodiscard]] iterator end() noexcept {
+        return iterator{this, NIL};
+    }
+
+    [[nodiscard]] const_iterator end() const noexcept {
+        return const_iterator{this, NIL};
+    }
+
+    [[nodiscard]] iterator find(const Key &key) {
+        return iterator{this, find_(key)};
+    }
+
+    [[nodiscard]] const_iterator find(const Key &key) const {
+        return const_iterator{this, find_(key)};
+    }
+
+    [[nodiscard]] bool contains(const Key &key) const {
+        return find_(key) != NIL;
+    }
+
+    [[nodiscard]] size_type count(const Key &key) const {
+        return contains(key) ? 1 : 0;
+    }
+
+    // Returns an iterator pointing to the first element that is not less than
+    // (i.e. greater or equal to) key
+    [[nodiscard]] iterator lower_bound(const Key &key) {
+        return iterator{this, bound(key, false)};
+    }
+
+    [[nodiscard]] const_iterator lower_bound(const Key &key) const {
+        return const_iterator{this, bound(key, false)};
+    }
+
+    // Returns an iterator pointing to the first element that is greater than key
+    [[nodiscard]] iterator upper_bound(const Key &key) {
+        return iterator{this, bound(key, true)};
+    }
+
+    [[nodiscard]] const_iterator upper_bound(const Key &key) const {
+        return const_iterator{this, bound(key, true)};
+    }
+
+    // Returns the element with key and true, or the element that was already
+    // there and false
+    std::pair<iterator, bool> insert(const value_type &value) {
+        // value may live in the file, which allocate() can remap
+        const value_type copy = value;
+        offset par = NIL;
+        bool left = false;
+        for (offset n = head().root; n != NIL; ) {
+            const node *x = ptr(n);
+            par = n;
+            if (comp(copy.first, x->record.first)) {
+                left = true;
+                n = x->left;
+            } else if (comp(x->record.first, copy.first)) {
+                left = false;
+                n = x->right;
+            } else {
+                return {iterator{this, n}, false};
+            }
+        }
+        const offset res = allocate();
+        ::new (static_cast<void *>(ptr(res))) node{copy, NIL, NIL, par, static_cast<priority>(generator())};
+        impl::mapped_header &h = head();
+        if (par == NIL) {
+            h.root = res;
+            h.leftmost = res;
+            h.rightmost = res;
+        } else if (left) {
+            ptr(par)->left = res;
+            if (par == h.leftmost) {
+                h.leftmost = res;
+            }
+        } else {
+            ptr(par)->right = res;
+            if (par == h.rightmost) {
+                h.rightmost = res;
+            }
+        }
+        h.size++;
+        sift_up(res);
+        return {iterator{this, res}, true};
+    }
+
+    // The returned reference is only good until the next insert
+    T &operator[](const Key &key) {
+        return insert(value_type(key, T{})).first->second;
+    }
+
+    // Returns the iterator following pos
+    iterator erase(const_iterator pos) {
+        const offset n = pos.off;
+        const offset next = successor(n);
+        impl::mapped_header &h = head();
+        if (h.leftmost == n) {
+            h.leftmost = next;
+        }
+        if (h.rightmost == n) {
+            h.rightmost = predecessor(n);
+        }
+        // Rotate n down until it has at most one child, which takes its place
+        node *x = ptr(n);
+        while (x->left != NIL && x->right != NIL) {
+            rotate_up(ptr(x->left)->pri > ptr(x->right)->pri ? x->left : x->right);
+        }
+        const offset child = x->left != NIL ? x->left : x->right;
+        if (child != NIL) {
+            ptr(child)->par = x->par;
+        }
+        replace_child(x->par, n, child);
+        x->left = h.free_list;
+        h.free_list = n;
+        h.size--;
+        return iterator{this, next};
+    }
+
+    // Returns the number of elements removed
+    size_type erase(const Key &key) {
+        const offset n = find_(key);
+        if (n == NIL) {
+            return 0;
+        }
+        erase(const_iterator{this, n});
+        return 1;
+    }
+
+    // Drops every element, keeping the file at its current size
+    void clear() noexcept {
+        impl::mapped_header &h = head();
+        h.root = NIL;
+        h.leftmost = NIL;
+        h.rightmost = NIL;
+        h.size = 0;
+        h.free_list = NIL;
+        h.used = FIRST_NODE;
+    }
+
+private:
+    [[nodiscard]] impl::mapped_header &head() const noexcept {
+        return *reinterpret_cast<impl::mapped_header *>(base);
+    }
+
+    [[nodiscard]] node *ptr(offset off) const noexcept {
+        return reinterpret_cast<node *>(base + off);
+    }
+
+    [[nodiscard]] static impl::mapped_header expected_header() {
+        impl::mapped_header res{};
+        std::memcpy(res.magic, impl::mapped_header::MAGIC, sizeof res.magic);
+        res.version = impl::mapped_header::VERSION;
+        res.order_mark = impl::mapped_header::ORDER_MARK;
+        res.key_size = sizeof(Key);
+        res.mapped_size = sizeof(T);
+        res.node_size = sizeof(node);
+        return res;
+    }
+
+    void create(size_type bytes) {
+        map(bytes);
+        impl::mapped_header h = expected_header();
+        h.used = FIRST_NODE;
+        std::memcpy(base, &h, sizeof h);
+    }
+
+    void open_existing(size_type bytes) {
+        if (bytes < FIRST_NODE) {
+            throw std::runtime_error("bst: mapped_map file is truncated");
+        }
+        map(bytes);
+        // Everything before root describes the format
+        const impl::mapped_header expected = expected_header();
+        constexpr std::size_t format_bytes = offsetof(impl::mapped_header, root);
+        const impl::mapped_header &h = head();
+        if (std::memcmp(&h, &expected, format_bytes) != 0) {
+            throw std::runtime_error("bst: mapped_map file holds another format or type");
+        }
+        if (h.used < FIRST_NODE || h.used > capacity) {
+            throw std::runtime_error("bst: mapped_map file is corrupt");
+        }
+    }
+
+    // Sets the file to bytes and maps all of it
+    void map(size_type bytes) {
+        if (::ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+            impl::throw_errno("bst: could not resize mapped_map file");
+        }
+        void *res = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (res == MAP_FAILED) {
+            impl::throw_errno("bst: could not map mapped_map file");
+        }
+        // Only let go of the old mapping once the new one is in place
+        if (base != nullptr) {
+            ::munmap(base, capacity);
+        }
+        base = static_cast<char *>(res);
+        capacity = bytes;
+    }
+
+    void release() noexcept {
+        if (base != nullptr) {
+            ::munmap(base, capacity);
+            base = nullptr;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    // Returns a free node, from the free list or the end of the used space
+    // May remap the file
+    [[nodiscard]] offset allocate() {
+        impl::mapped_header &h = head();
+        if (h.free_list != NIL) {
+            const offset res = h.free_list;
+            h.free_list = ptr(res)->left;
+            return res;
+        }
+        const offset res = h.used;
+        if (res + sizeof(node) > capacity) {
+            map(std::max<size_type>(capacity * 2, res + sizeof(node)));
+        }
+        head().used = res + sizeof(node);
+        return res;
+    }
+
+    [[nodiscard]] offset find_(const Key &key) const {
+        const offset res = bound(key, false);
+        return res != NIL && !comp(key, ptr(res)->record.first) ? res : NIL;
+    }
+
+    // First node not less than key, or greater than key with strict
+    [[nodiscard]] offset bound(const Key &key, bool strict) const {
+        offset res = NIL;
+        for (offset n = head().root; n != NIL; ) {
+            const node *x = ptr(n);
+            if (strict ? comp(key, x->record.first) : !comp(x->record.first, key)) {
+                res = n;
+                n = x->left;
+            } else {
+                n = x->right;
+            }
+        }
+        return res;
+    }
+
+    [[nodiscard]] offset successor(offset n) const {
+        const node *x = ptr(n);
+        if (x->right != NIL) {
+            n = x->right;
+            while (ptr(n)->left != NIL) {
+                n = ptr(n)->left;
+            }
+            return n;
+        }
+        while (x->par != NIL && ptr(x->par)->right == n) {
+            n = x->par;
+            x = ptr(n);
+        }
+        return x->par;
+    }
+
+    [[nodiscard]] offset predecessor(offset n) const {
+        const node *x = ptr(n);
+        if (x->left != NIL) {
+            n = x->left;
+            while (ptr(n)->right != NIL) {
+                n = ptr(n)->right;
+            }
+            return n;
+        }
+        while (x->par != NIL && ptr(x->par)->left == n) {
+            n = x->par;
+            x = ptr(n);
+        }
+        return x->par;
+    }
+
+    // Points par's link to old at n instead, or the root if par is NIL
+    void replace_child(offset par, offset old, offset n) {
+        if (par == NIL) {
+            head().root = n;
+        } else if (ptr(par)->left == old) {
+            ptr(par)->left = n;
+        } else {
+            ptr(par)->right = n;
+        }
+    }
+
+    // n takes the place of its parent, which becomes its child
+    void rotate_up(offset n) {
+        node *x = ptr(n);
+        const offset p = x->par;
+        node *y = ptr(p);
+        if (y->left == n) {
+            y->left = x->right;
+            if (x->right != NIL) {
+                ptr(x->right)->par = p;
+            }
+            x->right = p;
+        } else {
+            y->right = x->left;
+            if (x->left != NIL) {
+                ptr(x->left)->par = p;
+            }
+            x->left = p;
+        }
+        x->par = y->par;
+        y->par = n;
+        replace_child(x->par, p, n);
+    }
+
+    void sift_up(offset n) {
+        while (ptr(n)->par != NIL && ptr(ptr(n)->par)->pri < ptr(n)->pri) {
+            rotate_up(n);
+        }
+    }
+
+    Compare comp;
+    int fd{-1};
+    char *base{};
+    size_type capacity{};
+
+    inline static std::minstd_rand generator{}; // NOLINT(cert-msc51-cpp)
+};
+
+}
+
+#endif //BST_MAPPED_MAP_H
@@ -0,0 +1,457 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#ifndef BST_SMALL_MAP_H
+#define BST_SMALL_MAP_H
+
+#include <cstddef> // std::ptrdiff_t, std::size_t
+#include <cstdint> // std::uint8_t, UINT8_MAX
+
+#include <algorithm>   // std::rotate
+#include <functional>  // std::less
+#include <iterator>    // std::bidirectional_iterator_tag, std::distance
+#include <memory>      // std::allocator, std::destroy_at
+#include <new>         // std::launder, placement new
+#include <tuple>       // std::forward_as_tuple, std::tuple
+#include <type_traits> // std::conditional_t, std::enable_if_t, std::is_lvalue_reference_v, std::is_nothrow_move_constructible_v
+#include <utility>     // std::forward, std::move, std::pair, std::piecewise_construct
+
+#include "bst.h"
+
+namespace bst {
+
+namespace impl {
+
+// A set or map that keeps up to N elements in slots inside the object, and
+// only moves them into a treap once it outgrows them, so that the many maps
+// that never get big don't allocate at all
+// Elements stay in the slot they were put in. order lists the slots holding
+// elements by key, followed by the free ones, so inserting and erasing only
+// shuffle bytes and a lookup is a binary search through order
+// A map that has spilled into its tree only moves back into the slots once it
+// is down to N / 2 elements, so one that hovers around N doesn't keep going
+// back and forth. Iterators, pointers and references are invalidated when it
+// moves either way, and otherwise follow the rules of the tree
+template<class Key, class T, std::size_t N, class Compare, class Allocator>
+class small_tree {
+    static_assert(N > 0 && N <= UINT8_MAX, "small_tree numbers its slots with bytes");
+
+    using tree_type = treap<Key, T, Compare, Allocator>;
+    using slot = std::uint8_t;
+
+public:
+    using key_type = Key;
+    using value_type = typename tree_type::value_type;
+    using size_type = std::size_t;
+    using allocator_type = Allocator;
+    using key_compare = Compare;
+
+    // Either a rank into the slots or an iterator into the tree, whichever
+    // the map is using
+    template<bool Const>
+    class iter {
+        using owner_pointer = std::conditional_t<Const, const small_tree *, small_tree *>;
+        using tree_iterator = std::conditional_t<Const, typename tree_type::const_iterator,
+                                                 typename tree_type::iterator>;
+
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = std::conditional_t<Const, const typename small_tree::value_type,
+                                              typename small_tree::value_type>;
+        using pointer = value_type *;
+        using reference = value_type &;
+
+        template<bool C = Const, std::enable_if_t<C, bool> = true>
+        iter(const iter<false> &other) : owner(other.owner), rank(other.rank), it(other.it) {} // NOLINT(google-explicit-constructor)
+
+        reference operator*() const {
+            if (owner != nullptr) {
+                return owner->at(rank);
+            }
+            tree_iterator copy = it;
+            return *copy;
+        }
+
+        pointer operator->() const {
+            return &**this;
+        }
+
+        iter &operator++() {
+            if (owner != nullptr) {
+                rank++;
+            } else {
+                ++it;
+            }
+            return *this;
+        }
+
+        iter operator++(int) { // NOLINT(cert-dcl21-cpp)
+            iter res = *this;
+            ++*this;
+            return res;
+        }
+
+        iter &operator--() {
+            if (owner != nullptr) {
+                rank--;
+            } else {
+                --it;
+            }
+            return *this;
+        }
+
+        iter operator--(int) { // NOLINT(cert-dcl21-cpp)
+            iter res = *this;
+            --*this;
+            return res;
+        }
+
+        friend bool operator==(const iter &lhs, const iter &rhs) {
+            return lhs.rank == rhs.rank && lhs.it == rhs.it;
+        }
+
+        friend bool operator!=(const iter &lhs, const iter &rhs) {
+            return !(lhs == rhs);
+        }
+
+    private:
+        friend small_tree;
+        friend class iter<!Const>;
+
+        // Into the slots
+        iter(owner_pointer owner, size_type rank, tree_iterator end) : owner(owner), rank(rank), it(end) {}
+
+        // Into the tree
+        explicit iter(tree_iterator it) : it(it) {}
+
+        owner_pointer owner{};
+        size_type rank{};
+        tree_iterator it;
+    };
+
+    using iterator = iter<false>;
+    using const_iterator = iter<true>;
+
+    small_tree() : small_tree(Compare()) {}
+
+    explicit small_tree(const Compare &comp, const Allocator &alloc = Allocator()) : tree(comp, alloc) {
+        reset_order();
+    }
+
+    small_tree(const small_tree &other) : tree(other.tree), spilled(other.spilled) {
+        reset_order();
+        take_slots(other);
+    }
+
+    small_tree(small_tree &&other) noexcept(std::is_nothrow_move_constructible_v<value_type>)
+            : tree(std::move(other.tree)),
+              spilled(other.spilled) {
+        reset_order();
+        take_slots(std::move(other));
+    }
+
+    small_tree &operator=(const small_tree &other) {
+        if (this != &other) {
+            small_tree tmp(other);
+            *this = std::move(tmp);
+        }
+        return *this;
+    }
+
+    small_tree &operator=(small_tree &&other) noexcept(std::is_nothrow_move_constructible_v<value_type>) {
+        if (this != &other) {
+            clear();
+            tree = std::move(other.tree);
+            spilled = other.spilled;
+            take_slots(std::move(other));
+        }
+        return *this;
+    }
+
+    ~small_tree() {
+        destroy_slots();
+    }
+
+    void swap(small_tree &other) {
+        small_tree tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    [[nodiscard]] iterator begin() noexcept {
+        return spilled ? iterator{tree.begin()} : iterator{this, 0, tree.end()};
+    }
+
+    [[nodiscard]] const_iterator begin() const noexcept {
+        return spilled ? const_iterator{tree.begin()} : const_iterator{this, 0, tree.end()};
+    }
+
+    [[nodiscard]] iterator end() noexcept {
+        return spilled ? iterator{tree.end()} : iterator{this, count_, tree.end()};
+    }
+
+    [[nodiscard]] const_iterator end() const noexcept {
+        return spilled ? const_iterator{tree.end()} : const_iterator{this, count_, tree.end()};
+    }
+
+    [[nodiscard]] size_type size() const noexcept {
+        return spilled ? tree.size() : count_;
+    }
+
+    [[nodiscard]] bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    // Bytes taken up by the container and, once it has spilled, its nodes
+    [[nodiscard]] size_type memory_usage() const noexcept {
+        return sizeof(small_tree) - sizeof(tree_type) + tree.memory_usage();
+    }
+
+    [[nodiscard]] iterator find(const Key &key) {
+        if (spilled) {
+            return iterator{tree.find(key)};
+        }
+        const size_type rank = lower_rank(key);
+        return rank < count_ && !less(key, key_of(at(rank))) ? iterator{this, rank, tree.end()} : end();
+    }
+
+    [[nodiscard]] size_type count(const Key &key) {
+        return find(key) == end() ? 0 : 1;
+    }
+
+    [[nodiscard]] iterator lower_bound(const Key &key) {
+        return spilled ? iterator{tree.lower_bound(key)} : iterator{this, lower_rank(key), tree.end()};
+    }
+
+    [[nodiscard]] iterator upper_bound(const Key &key) {
+        return spilled ? iterator{tree.upper_bound(key)} : iterator{this, upper_rank(key), tree.end()};
+    }
+
+    [[nodiscard]] std::pair<iterator, iterator> equal_range(const Key &key) {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    // Insertion fails when an element with the same key already exists
+    // In that case, the returned iterator points to that element
+    std::pair<iterator, bool> insert(const value_type &value) {
+        if (!spilled) {
+            const Key &key = key_of(value);
+            const size_type rank = lower_rank(key);
+            if (rank < count_ && !less(key, key_of(at(rank)))) {
+                return {iterator{this, rank, tree.end()}, false};
+            }
+            if (count_ < N) {
+                insert_slot(rank, value);
+                return {iterator{this, rank, tree.end()}, true};
+            }
+            spill();
+        }
+        const auto [it, inserted] = tree.insert(value);
+        return {iterator{it}, inserted};
+    }
+
+    template<typename U = T>
+    std::enable_if_t<!is_null_type<U>, U &> operator[](const Key &key) {
+        if (auto it = find(key); it != end()) {
+            return it->second;
+        }
+        return insert(value_type(std::piecewise_construct, std::forward_as_tuple(key), std::tuple<>())).first->second;
+    }
+
+    // Returns the iterator following pos
+    iterator erase(const_iterator pos) {
+        if (!spilled) {
+            erase_slot(pos.rank);
+            return iterator{this, pos.rank, tree.end()};
+        }
+        const auto next = tree.erase(typename tree_type::iterator(pos.it));
+        if (tree.size() > N / 2) {
+            return iterator{next};
+        }
+        const auto rank = static_cast<size_type>(std::distance(tree.begin(), next));
+        return unspill() ? iterator{this, rank, tree.end()} : iterator{next};
+    }
+
+    // Returns the number of elements removed
+    size_type erase(const Key &key) {
+        const iterator it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    // Also moves the map back into its slots
+    void clear() noexcept {
+        destroy_slots();
+        tree.clear();
+        spilled = false;
+    }
+
+    [[nodiscard]] key_compare key_comp() const {
+        return tree.key_comp();
+    }
+
+    [[nodiscard]] allocator_type get_allocator() const noexcept {
+        return tree.get_allocator();
+    }
+
+private:
+    struct alignas(value_type) storage {
+        unsigned char bytes[sizeof(value_type)];
+    };
+
+    [[nodiscard]] static const Key &key_of(const value_type &value) {
+        if constexpr (is_null_type<T>) {
+            return value;
+        } else {
+            return value.first;
+        }
+    }
+
+    [[nodiscard]] bool less(const Key &lhs, const Key &rhs) const {
+        if constexpr (is_three_way<Compare, Key>) {
+            return tree.key_comp()(lhs, rhs) < 0;
+        } else {
+            return tree.key_comp()(lhs, rhs);
+        }
+    }
+
+    [[nodiscard]] value_type &at(size_type rank) {
+        return *std::launder(reinterpret_cast<value_type *>(slots[order[rank]].bytes));
+    }
+
+    [[nodiscard]] const value_type &at(size_type rank) const {
+        return *std::launder(reinterpret_cast<const value_type *>(slots[order[rank]].bytes));
+    }
+
+    // Rank of the first element not less than key
+    [[nodiscard]] size_type lower_rank(const Key &key) const {
+        size_type lo = 0;
+        size_type hi = count_;
+        while (lo < hi) {
+            const size_type mid = (lo + hi) / 2;
+            if (less(key_of(at(mid)), key)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    // Rank of the first element greater than key
+    [[nodiscard]] size_type upper_rank(const Key &key) const {
+        size_type lo = 0;
+        size_type hi = count_;
+        while (lo < hi) {
+            const size_type mid = (lo + hi) / 2;
+            if (less(key, key_of(at(mid)))) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        return lo;
+    }
+
+    void reset_order() noexcept {
+        for (size_type i = 0; i < N; i++) {
+            order[i] = static_cast<slot>(i);
+        }
+    }
+
+    // Puts value in the first free slot and gives it rank
+    template<class V>
+    void insert_slot(size_type rank, V &&value) {
+        ::new (static_cast<void *>(slots[order[count_]].bytes)) value_type(std::forward<V>(value));
+        std::rotate(order + rank, order + count_, order + count_ + 1);
+        count_++;
+    }
+
+    // The freed slot goes to the front of the free ones
+    void erase_slot(size_type rank) noexcept {
+        std::destroy_at(&at(rank));
+        std::rotate(order + rank, order + rank + 1, order + count_);
+        count_--;
+    }
+
+    void destroy_slots() noexcept {
+        while (count_ > 0) {
+            erase_slot(count_ - 1);
+        }
+    }
+
+    // Copies or moves other's slots into this one's, which are empty
+    template<class Other>
+    void take_slots(Other &&other) {
+        try {
+            for (size_type rank = 0; rank < other.count_; rank++) {
+                if constexpr (std::is_lvalue_reference_v<Other>) {
+                    insert_slot(rank, other.at(rank));
+                } else {
+                    insert_slot(rank, std::move(other.at(rank)));
+                }
+            }
+        } catch (...) {
+            destroy_slots();
+            throw;
+        }
+    }
+
+    // The slots are full: copies them into the tree and empties them
+    // Leaves the map as it was if that throws
+    void spill() {
+        try {
+            for (size_type rank = 0; rank < count_; rank++) {
+                tree.insert(at(rank));
+            }
+        } catch (...) {
+            tree.clear();
+            throw;
+        }
+        destroy_slots();
+        spilled = true;
+    }
+
+    // Copies the tree, which is small enough now, back into the slots and
+    // empties it. Only an optimisation, so if copying an element throws, the
+    // map just stays in the tree
+    bool unspill() noexcept {
+        try {
+            for (const value_type &value : tree) {
+                insert_slot(count_, value);
+            }
+        } catch (...) {
+            destroy_slots();
+            return false;
+        }
+        tree.clear();
+        spilled = false;
+        return true;
+    }
+
+    tree_type tree;
+    storage slots[N];
+    slot order[N];
+    slot count_{};
+    bool spilled{};
+};
+
+}
+
+// Holds up to N elements without allocating, see bst::impl::small_tree
+template<class Key, std::size_t N = 8, class Compare = std::less<Key>, class Allocator = std::allocator<Key>>
+using small_set = impl::small_tree<Key, impl::null_type, N, Compare, Allocator>;
+
+// Holds up to N elements without allocating, see bst::impl::small_tree
+template<class Key, class T, std::size_t N = 8, class Compare = std::less<Key>,
+         class Allocator = std::allocator<std::pair<const Key, T>>>
+using small_map = impl::small_tree<Key, T, N, Compare, Allocator>;
+
+}
+
+#endif //BST_SMALL_MAP_H
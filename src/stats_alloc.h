@@ -0,0 +1,199 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#ifndef BST_STATS_ALLOC_H
+#define BST_STATS_ALLOC_H
+
+#include <cstddef> // std::size_t
+#include <cstdint> // std::uint64_t
+
+#include <algorithm> // std::find
+#include <array>     // std::array
+#include <atomic>    // std::atomic, std::memory_order_relaxed
+#include <memory>    // std::allocator
+#include <mutex>     // std::lock_guard, std::mutex
+#include <vector>    // std::vector
+
+namespace bst {
+
+// Snapshot of what went through every stats_allocator sharing a tag
+struct alloc_stats {
+    // Requests are bucketed by the number of bytes, rounded up to a power of 2:
+    // bucket i counts requests of (2^(i-1), 2^i] bytes, the last one everything bigger
+    static constexpr std::size_t histogram_buckets = 32;
+
+    std::uint64_t live_bytes{};
+    std::uint64_t peak_bytes{};
+    std::uint64_t allocations{};
+    std::uint64_t deallocations{};
+    std::array<std::uint64_t, histogram_buckets> histogram{};
+};
+
+namespace impl {
+
+// Live and peak bytes are shared atomics, as the peak of a sum can't be
+// recovered from per-thread values. Everything else is counted per thread,
+// without read-modify-write, and only summed up when stats are read
+template<class Tag>
+class alloc_counters {
+public:
+    static void on_allocate(std::size_t bytes) {
+        const std::uint64_t live = live_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        std::uint64_t peak = peak_bytes.load(std::memory_order_relaxed);
+        while (live > peak && !peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+        per_thread &t = local();
+        bump(t.allocations);
+        bump(t.histogram[bucket_of(bytes)]);
+    }
+
+    static void on_deallocate(std::size_t bytes) {
+        live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+        bump(local().deallocations);
+    }
+
+    [[nodiscard]] static alloc_stats snapshot() {
+        alloc_stats res;
+        res.live_bytes = live_bytes.load(std::memory_order_relaxed);
+        res.peak_bytes = peak_bytes.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        add_to(res, retired);
+        for (const per_thread *t : registry) {
+            add_to(res, *t);
+        }
+        return res;
+    }
+
+    // Starts a new measurement: the peak drops to what is live right now
+    // and the counts go back to 0
+    static void reset() {
+        peak_bytes.store(live_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        clear(retired);
+        for (per_thread *t : registry) {
+            clear(*t);
+        }
+    }
+
+private:
+    struct per_thread {
+        std::atomic<std::uint64_t> allocations{};
+        std::atomic<std::uint64_t> deallocations{};
+        std::array<std::atomic<std::uint64_t>, alloc_stats::histogram_buckets> histogram{};
+    };
+
+    // Registers the counters of the calling thread for as long as it lives
+    // and folds them into retired when it exits
+    struct registration {
+        registration() {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            registry.push_back(&counters);
+        }
+
+        ~registration() {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            registry.erase(std::find(registry.begin(), registry.end(), &counters));
+            bump(retired.allocations, counters.allocations.load(std::memory_order_relaxed));
+            bump(retired.deallocations, counters.deallocations.load(std::memory_order_relaxed));
+            for (std::size_t i = 0; i < alloc_stats::histogram_buckets; i++) {
+                bump(retired.histogram[i], counters.histogram[i].load(std::memory_order_relaxed));
+            }
+        }
+
+        per_thread counters;
+    };
+
+    static per_thread &local() {
+        thread_local registration r;
+        return r.counters;
+    }
+
+    // Only the owning thread writes, so a plain load and store is enough
+    static void bump(std::atomic<std::uint64_t> &counter, std::uint64_t by = 1) {
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] static std::size_t bucket_of(std::size_t bytes) {
+        std::size_t bucket = 0;
+        while (bucket + 1 < alloc_stats::histogram_buckets && (std::size_t{1} << bucket) < bytes) {
+            bucket++;
+        }
+        return bucket;
+    }
+
+    static void add_to(alloc_stats &res, const per_thread &t) {
+        res.allocations += t.allocations.load(std::memory_order_relaxed);
+        res.deallocations += t.deallocations.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < alloc_stats::histogram_buckets; i++) {
+            res.histogram[i] += t.histogram[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    static void clear(per_thread &t) {
+        t.allocations.store(0, std::memory_order_relaxed);
+        t.deallocations.store(0, std::memory_order_relaxed);
+        for (auto &count : t.histogram) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    inline static std::atomic<std::uint64_t> live_bytes{};
+    inline static std::atomic<std::uint64_t> peak_bytes{};
+    inline static std::mutex registry_mutex;
+    inline static std::vector<per_thread *> registry;
+    inline static per_thread retired;
+};
+
+}
+
+// std::allocator that keeps count of what it hands out, cheaply enough to be
+// left on in benchmarks and production
+// Every stats_allocator with the same Tag, whatever its T, shares one set of
+// counters, so give each container (or group of them) a tag of its own to
+// tell them apart
+template<class T, class Tag = void>
+class stats_allocator : public std::allocator<T> {
+public:
+    using value_type = T;
+
+    template<class U>
+    struct rebind { using other = stats_allocator<U, Tag>; };
+
+    stats_allocator() noexcept = default;
+
+    template<class U>
+    stats_allocator(const stats_allocator<U, Tag> &) noexcept {} // NOLINT(google-explicit-constructor)
+
+    [[nodiscard]] T *allocate(std::size_t n) {
+        T *p = std::allocator<T>::allocate(n);
+        impl::alloc_counters<Tag>::on_allocate(n * sizeof(T));
+        return p;
+    }
+
+    void deallocate(T *p, std::size_t n) {
+        impl::alloc_counters<Tag>::on_deallocate(n * sizeof(T));
+        std::allocator<T>::deallocate(p, n);
+    }
+
+    [[nodiscard]] static alloc_stats stats() {
+        return impl::alloc_counters<Tag>::snapshot();
+    }
+
+    static void reset_stats() {
+        impl::alloc_counters<Tag>::reset();
+    }
+
+    template<class U>
+    bool operator==(const stats_allocator<U, Tag> &) const noexcept {
+        return true;
+    }
+
+    template<class U>
+    bool operator!=(const stats_allocator<U, Tag> &) const noexcept {
+        return false;
+    }
+};
+
+}
+
+#endif //BST_STATS_ALLOC_H
@@ -0,0 +1,238 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#ifndef BST_THREAD_POOL_H
+#define BST_THREAD_POOL_H
+
+#include <cstddef> // std::size_t
+
+#include <algorithm>          // std::inplace_merge, std::stable_sort
+#include <atomic>             // std::atomic, std::memory_order_acquire, std::memory_order_release
+#include <condition_variable> // std::condition_variable
+#include <deque>              // std::deque
+#include <exception>          // std::exception_ptr, std::current_exception, std::rethrow_exception
+#include <functional>         // std::function
+#include <memory>             // std::make_unique, std::unique_ptr
+#include <mutex>              // std::lock_guard, std::mutex, std::unique_lock
+#include <thread>             // std::thread
+#include <utility>            // std::move
+#include <vector>             // std::vector
+
+namespace bst {
+
+// Work-stealing thread pool behind the trees' parallel algorithms
+// Every worker has a queue of its own: it pushes and pops at the back, so it
+// keeps working on what it split off last (and still has in cache), while
+// idle workers steal from the front, where the biggest pieces of work are
+// Threads that aren't workers share one more queue
+// A thread waiting for its tasks runs queued tasks in the meantime, so tasks
+// can spawn and wait for tasks of their own without tying up the pool
+class thread_pool {
+public:
+    explicit thread_pool(std::size_t threads = std::thread::hardware_concurrency()) {
+        // The last queue is for threads from outside the pool
+        for (std::size_t i = 0; i <= threads; i++) {
+            queues.push_back(std::make_unique<queue>());
+        }
+        workers.reserve(threads);
+        for (std::size_t i = 0; i < threads; i++) {
+            workers.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    // Runs every task still queued before returning
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+    }
+
+    // The pool used when none is given, with a worker per hardware thread
+    [[nodiscard]] static thread_pool &shared() {
+        static thread_pool pool;
+        return pool;
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept {
+        return workers.size();
+    }
+
+    // Queues task on the calling thread's queue
+    void push(std::function<void()> task) {
+        queue &q = *queues[self()];
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            pending++;
+        }
+        wake.notify_one();
+    }
+
+    // Runs one queued task, the caller's own newest or else the oldest one
+    // it can steal, and returns whether there was any
+    bool run_one() {
+        const std::size_t own = self();
+        std::function<void()> task;
+        if (!pop_back(*queues[own], task)) {
+            bool stolen = false;
+            for (std::size_t i = 1; i < queues.size() && !stolen; i++) {
+                stolen = pop_front(*queues[(own + i) % queues.size()], task);
+            }
+            if (!stolen) {
+                return false;
+            }
+        }
+        task();
+        return true;
+    }
+
+private:
+    struct queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    // Index of the calling thread's queue
+    [[nodiscard]] std::size_t self() const noexcept {
+        return current_pool == this ? current_index : queues.size() - 1;
+    }
+
+    bool pop_back(queue &q, std::function<void()> &task) {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty()) {
+            return false;
+        }
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        pending--;
+        return true;
+    }
+
+    bool pop_front(queue &q, std::function<void()> &task) {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty()) {
+            return false;
+        }
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        pending--;
+        return true;
+    }
+
+    void work(std::size_t index) {
+        current_pool = this;
+        current_index = index;
+        for (;;) {
+            if (run_one()) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this] { return stopping || pending > 0; });
+            if (stopping && pending == 0) {
+                return;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<queue>> queues;
+    std::vector<std::thread> workers;
+    // Tasks queued and not taken yet. Only raised under sleep_mutex, so that
+    // a worker can't miss a wake-up between checking it and going to sleep
+    std::atomic<std::size_t> pending{};
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    bool stopping{};
+
+    inline static thread_local const thread_pool *current_pool{};
+    inline static thread_local std::size_t current_index{};
+};
+
+namespace impl {
+
+// Tasks spawned on a pool that can be waited for together
+// The first exception thrown by a task is rethrown by wait()
+class task_group {
+public:
+    explicit task_group(thread_pool &pool) : pool(pool) {}
+
+    task_group(const task_group &) = delete;
+    task_group &operator=(const task_group &) = delete;
+
+    // Tasks may still refer to the group, so it can't go before they are done
+    ~task_group() {
+        join();
+    }
+
+    template<class F>
+    void spawn(F f) {
+        outstanding.fetch_add(1, std::memory_order_relaxed);
+        pool.push([this, f = std::move(f)]() mutable {
+            try {
+                f();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+            // Last touch of this, which may be gone right after
+            outstanding.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    // Runs queued tasks until every task of the group is done
+    void wait() {
+        join();
+        if (error) {
+            std::rethrow_exception(std::exchange(error, nullptr));
+        }
+    }
+
+private:
+    void join() {
+        while (outstanding.load(std::memory_order_acquire) != 0) {
+            if (!pool.run_one()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    thread_pool &pool;
+    std::atomic<std::size_t> outstanding{};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+};
+
+// Merge sort that sorts the halves on pool, down to grain elements
+// Stable, like std::stable_sort, which it uses for the pieces
+template<class RandomIt, class Compare>
+void parallel_stable_sort(RandomIt first, RandomIt last, Compare comp, std::size_t grain, thread_pool &pool) {
+    if (static_cast<std::size_t>(last - first) <= grain) {
+        std::stable_sort(first, last, comp);
+        return;
+    }
+    const RandomIt mid = first + (last - first) / 2;
+    task_group group(pool);
+    group.spawn([=, &pool] { parallel_stable_sort(first, mid, comp, grain, pool); });
+    parallel_stable_sort(mid, last, comp, grain, pool);
+    group.wait();
+    std::inplace_merge(first, mid, last, comp);
+}
+
+}
+
+}
+
+#endif //BST_THREAD_POOL_H
@@ -0,0 +1,197 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#include <cstddef>  // std::size_t
+#include <cstdint>  // std::uint32_t
+#include <cstring>  // std::memcpy
+#include <iterator> // std::distance, std::next
+#include <map>      // std::map
+#include <random>   // std::minstd_rand
+#include <sstream>  // std::stringstream
+#include <string>   // std::string
+#include <vector>   // std::vector
+
+#include <gtest/gtest.h>
+
+#include "../src/bst.h"
+
+namespace {
+
+// Depth of key in m, the root being at depth 0, read off the pre-order of a
+// snapshot, or -1 if it isn't there
+int depth_of(const bst::adaptive_map<int, int> &m, int key) {
+    std::stringstream out;
+    m.save(out);
+    const std::string snapshot = out.str();
+    // Depths of the children still to come, the next one on top
+    std::vector<int> pending{0};
+    for (std::size_t pos = sizeof(bst::impl::snapshot_header); pos < snapshot.size();) {
+        const auto flags = static_cast<unsigned char>(snapshot[pos]);
+        int node_key;
+        std::memcpy(&node_key, &snapshot[pos + 1 + sizeof(std::uint32_t)], sizeof node_key);
+        pos += 1 + sizeof(std::uint32_t) + 2 * sizeof(int);
+        const int depth = pending.back();
+        pending.pop_back();
+        if (node_key == key) {
+            return depth;
+        }
+        if ((flags & 2) != 0) {
+            pending.push_back(depth + 1);
+        }
+        if ((flags & 1) != 0) {
+            pending.push_back(depth + 1);
+        }
+    }
+    return -1;
+}
+
+TEST(AdaptiveMap, LookupsDontChangeContents) {
+    bst::adaptive_map<int, int> m;
+    for (int i = 0; i < 1000; i++) {
+        m[i] = 2 * i;
+    }
+    for (int round = 0; round < 50; round++) {
+        for (int i = 0; i < 10; i++) {
+            ASSERT_NE(m.find(i * 7), m.end());
+            EXPECT_EQ(m.find(i * 7)->second, 14 * i);
+        }
+    }
+    EXPECT_EQ(m.size(), 1000);
+    int i = 0;
+    for (auto it = m.begin(); it != m.end(); ++it, ++i) {
+        EXPECT_EQ(it->first, i);
+        EXPECT_EQ(it->second, 2 * i);
+    }
+    EXPECT_EQ(i, 1000);
+}
+
+TEST(AdaptiveMap, IteratorsSurvivePromotionAndDecay) {
+    bst::adaptive_map<int, int> m;
+    for (int i = 0; i < 100; i++) {
+        m[i] = i;
+    }
+    auto it = m.find(42);
+    m.set_decay_period(16);
+    for (int i = 0; i < 1000; i++) {
+        std::ignore = m.find(i % 5);
+    }
+    m.decay();
+    EXPECT_EQ(it, m.find(42));
+    EXPECT_EQ(it->second, 42);
+    EXPECT_EQ(std::distance(m.begin(), m.end()), 100);
+    EXPECT_EQ(std::next(m.find(99)), m.end());
+}
+
+TEST(AdaptiveMap, LowerBoundStillCorrect) {
+    bst::adaptive_map<int, int> m;
+    for (int i = 9; i >= 1; i -= 2) {
+        m[i] = 0;
+    }
+    const int ans[] = {1, 1, 3, 3, 5, 5, 7, 7, 9, 9 };
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i <= 9; i++) {
+            EXPECT_EQ(m.lower_bound(i)->first, ans[i]);
+        }
+        EXPECT_EQ(m.lower_bound(10), m.end());
+    }
+}
+
+TEST(AdaptiveMap, SkewedRandomAgainstStdMap) {
+    bst::adaptive_map<int, int> m;
+    std::map<int, int> ref;
+    std::minstd_rand g;
+    m.set_decay_period(500);
+    for (int i = 0; i < 20000; i++) {
+        // Squaring skews the keys towards 0
+        const auto r = static_cast<int>(g() % 64);
+        const int key = r * r;
+        switch (g() % 4) {
+            case 0:
+                EXPECT_EQ(m.erase(key), ref.erase(key));
+                break;
+            case 1:
+                m[key] = i;
+                ref[key] = i;
+                break;
+            default:
+                EXPECT_EQ(m.find(key) == m.end(), ref.find(key) == ref.end());
+        }
+    }
+    ASSERT_EQ(m.size(), ref.size());
+    auto it = m.begin();
+    for (const auto &[key, value] : ref) {
+        EXPECT_EQ(it->first, key);
+        EXPECT_EQ(it->second, value);
+        ++it;
+    }
+}
+
+TEST(AdaptiveMap, HotKeysRiseAndDecaySinksThem) {
+    bst::adaptive_map<int, int> m;
+    for (int i = 0; i < 1000; i++) {
+        m[i] = i;
+    }
+    // Nothing ages by itself while the hot key is looked up
+    m.set_decay_period(1000000000);
+    int hot = 0;
+    for (int i = 0; i < 1000; i++) {
+        hot = depth_of(m, i) > depth_of(m, hot) ? i : hot;
+    }
+    const int cold_depth = depth_of(m, hot);
+    for (int i = 0; i < 200; i++) {
+        std::ignore = m.find(hot);
+    }
+    const int hot_depth = depth_of(m, hot);
+    EXPECT_LT(hot_depth, cold_depth / 2);
+    // 8 halvings bring its weight of about 200 back to about 1
+    for (int i = 0; i < 8; i++) {
+        m.decay();
+    }
+    EXPECT_GT(depth_of(m, hot), hot_depth);
+    EXPECT_EQ(m.size(), 1000);
+}
+
+TEST(AdaptiveMap, LookupsDecayALittleAtATime) {
+    bst::adaptive_map<int, int> m;
+    for (int i = 0; i < 1000; i++) {
+        m[i] = i;
+    }
+    m.set_decay_period(1000000000);
+    for (int i = 0; i < 200; i++) {
+        std::ignore = m.find(500);
+    }
+    const int hot_depth = depth_of(m, 500);
+    // Every element ages once per 1000 lookups. Those of key 0 can't push
+    // key 500 down by more than a level by themselves
+    m.set_decay_period(1000);
+    for (int i = 0; i < 8000; i++) {
+        std::ignore = m.find(0);
+    }
+    EXPECT_GT(depth_of(m, 500), hot_depth + 1);
+    EXPECT_EQ(m.size(), 1000);
+    int i = 0;
+    for (auto it = m.begin(); it != m.end(); ++it, ++i) {
+        EXPECT_EQ(it->first, i);
+    }
+}
+
+TEST(AdaptiveMap, StaysHeapOrderedAsLookupsDecay) {
+    bst::adaptive_map<int, int> m;
+    for (int i = 0; i < 1000; i++) {
+        m[i] = i;
+    }
+    std::minstd_rand g(12345);
+    for (int i = 0; i < 5000; i++) {
+        std::ignore = m.find(static_cast<int>(g() % 1000));
+    }
+    // load() rejects a node that outranks its parent
+    std::stringstream out;
+    m.save(out);
+    bst::adaptive_map<int, int> loaded;
+    ASSERT_NO_THROW(loaded.load(out));
+    EXPECT_EQ(loaded.size(), 1000);
+    EXPECT_EQ(depth_of(loaded, 500), depth_of(m, 500));
+}
+
+}
@@ -0,0 +1,363 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#include <cmath>   // std::log2
+#include <cstddef> // std::size_t
+
+#include <array>       // std::array
+#include <functional>  // std::less
+#include <iterator>    // std::back_inserter, std::next, std::prev
+#include <map>         // std::map
+#include <memory>      // std::allocator
+#include <random>      // std::minstd_rand
+#include <set>         // std::set
+#include <type_traits> // std::is_same_v
+#include <utility>     // std::make_pair, std::move
+#include <vector>      // std::vector
+
+#include <gtest/gtest.h>
+
+#include "../src/bst.h"
+
+namespace {
+
+template<class Set>
+class BackendSet : public testing::Test {};
+
+template<class Map>
+class BackendMap : public testing::Test {};
+
+// Treaps with the insertion strategy that isn't the default
+constexpr bool other_insert = BST_TREAP_INSERT != BST_TOP_DOWN;
+using other_treap_set = bst::impl::treap<int, bst::impl::null_type, std::less<int>, std::allocator<int>, false, false,
+                                         other_insert>;
+using other_treap_map = bst::impl::treap<int, int, std::less<int>, std::allocator<std::pair<const int, int>>, false,
+                                         false, other_insert>;
+
+using set_types = testing::Types<bst::treap_set<int>, bst::avl_set<int>, bst::rb_set<int>, bst::scapegoat_set<int>,
+                                 other_treap_set>;
+using map_types = testing::Types<bst::treap_map<int, int>, bst::avl_map<int, int>, bst::rb_map<int, int>,
+                                 bst::scapegoat_map<int, int>, other_treap_map>;
+
+TYPED_TEST_SUITE(BackendSet, set_types);
+TYPED_TEST_SUITE(BackendMap, map_types);
+
+TYPED_TEST(BackendSet, SortedInsertIterates) {
+    TypeParam s;
+    for (int i = 0; i < 1000; i++) {
+        s.insert(i);
+    }
+    EXPECT_EQ(s.size(), 1000);
+    int i = 0;
+    for (auto it = s.begin(); it != s.end(); ++it) {
+        EXPECT_EQ(*it, i++);
+    }
+    for (auto it = s.end(); it != s.begin(); ) {
+        EXPECT_EQ(*--it, --i);
+    }
+}
+
+// The balancing state a tree keeps outside its nodes (e.g. the scapegoat
+// tree's size bound) has to go along with the nodes, and go with them
+TYPED_TEST(BackendSet, SwapAndClearCarryBalancingState) {
+    TypeParam s;
+    for (int i = 0; i < 1023; i++) {
+        s.insert(i);
+    }
+    for (int i = 0; i < 600; i++) {
+        s.erase(i);
+    }
+    TypeParam other;
+    other.swap(s);
+    EXPECT_TRUE(s.empty());
+    // Enough sorted inserts past the end to have the scapegoat tree rebuild
+    for (int i = 1023; i < 1523; i++) {
+        other.insert(i);
+        s.insert(i);
+    }
+    EXPECT_EQ(other.size(), 923);
+    EXPECT_EQ(s.size(), 500);
+    EXPECT_EQ(*other.begin(), 600);
+    EXPECT_EQ(*std::prev(other.end()), 1522);
+
+    other.clear();
+    for (int i = 0; i < 100; i++) {
+        other.insert(i);
+    }
+    EXPECT_EQ(other.size(), 100);
+    if constexpr (std::is_same_v<TypeParam, bst::scapegoat_set<int>>) {
+        // Nodes are at most log_{3/2}(100) deep, not log_{3/2}(1623)
+        EXPECT_LE(other.shape().height, 12);
+    }
+}
+
+template<class Set>
+class BalancedSet : public testing::Test {};
+
+using balanced_set_types = testing::Types<bst::avl_set<int>, bst::rb_set<int>>;
+
+TYPED_TEST_SUITE(BalancedSet, balanced_set_types);
+
+// Worst-case number of levels with n nodes
+template<class Set>
+double max_height(std::size_t n) {
+    if constexpr (std::is_same_v<Set, bst::avl_set<int>>) {
+        return 1.44 * std::log2(static_cast<double>(n) + 2);
+    } else {
+        return 2 * std::log2(static_cast<double>(n) + 1);
+    }
+}
+
+// Sorted inserts are what an unbalanced tree turns into a list
+TYPED_TEST(BalancedSet, SortedInsertKeepsHeightBound) {
+    for (const bool ascending : {true, false}) {
+        TypeParam s;
+        for (int i = 0; i < 5000; i++) {
+            s.insert(ascending ? i : -i);
+            if (i % 97 == 0) {
+                ASSERT_LE(s.shape().height, max_height<TypeParam>(s.size())) << s.size() << " elements";
+            }
+        }
+        // Erasing every other element has to rebalance too
+        for (int i = 0; i < 5000; i += 2) {
+            s.erase(ascending ? i : -i);
+            if (i % 194 == 0) {
+                ASSERT_LE(s.shape().height, max_height<TypeParam>(s.size())) << s.size() << " elements";
+            }
+        }
+    }
+}
+
+TYPED_TEST(BackendSet, EraseKeepsOtherIterators) {
+    TypeParam s;
+    for (int i = 0; i < 100; i++) {
+        s.insert(i);
+    }
+    auto keep = s.find(50);
+    for (int i = 0; i < 100; i++) {
+        if (i != 50) {
+            s.erase(i);
+        }
+    }
+    EXPECT_EQ(s.size(), 1);
+    EXPECT_EQ(keep, s.begin());
+    EXPECT_EQ(std::next(keep), s.end());
+}
+
+TYPED_TEST(BackendSet, RandomAgainstStdSet) {
+    TypeParam s;
+    std::set<int> ref;
+    std::minstd_rand g;
+    for (int i = 0; i < 20000; i++) {
+        const int key = static_cast<int>(g() % 2000);
+        if (g() % 3 == 0) {
+            EXPECT_EQ(s.erase(key), ref.erase(key));
+        } else {
+            EXPECT_EQ(s.insert(key).second, ref.insert(key).second);
+        }
+        EXPECT_EQ(s.size(), ref.size());
+    }
+    auto it = s.begin();
+    for (int key : ref) {
+        ASSERT_NE(it, s.end());
+        EXPECT_EQ(*it, key);
+        EXPECT_EQ(it, std::prev(std::next(it)));
+        ++it;
+    }
+    EXPECT_EQ(it, s.end());
+    for (int i = 0; i < 2000; i++) {
+        EXPECT_EQ(s.find(i) != s.end(), ref.count(i) == 1);
+    }
+}
+
+TYPED_TEST(BackendMap, RandomAgainstStdMap) {
+    TypeParam m;
+    std::map<int, int> ref;
+    std::minstd_rand g;
+    for (int i = 0; i < 20000; i++) {
+        const int key = static_cast<int>(g() % 2000);
+        const int value = static_cast<int>(g());
+        if (g() % 3 == 0) {
+            auto it = m.find(key);
+            if (it != m.end()) {
+                auto next = m.erase(it);
+                auto ref_next = ref.erase(ref.find(key));
+                EXPECT_EQ(next == m.end(), ref_next == ref.end());
+            }
+        } else {
+            m[key] = value;
+            ref[key] = value;
+        }
+        EXPECT_EQ(m.size(), ref.size());
+    }
+    auto it = m.begin();
+    for (const auto &[key, value] : ref) {
+        ASSERT_NE(it, m.end());
+        EXPECT_EQ(it->first, key);
+        EXPECT_EQ(it->second, value);
+        ++it;
+    }
+    EXPECT_EQ(it, m.end());
+}
+
+TYPED_TEST(BackendSet, CopyRangeMatchesIterators) {
+    TypeParam s;
+    std::minstd_rand g;
+    for (int i = 0; i < 5000; i++) {
+        s.insert(static_cast<int>(g() % 10000));
+    }
+    for (const auto &[lo, hi] : {std::make_pair(0, 10000), std::make_pair(-5, 3), std::make_pair(1234, 5678),
+                                 std::make_pair(9990, 20000), std::make_pair(50, 50), std::make_pair(60, 40)}) {
+        std::vector<int> got;
+        s.copy_range(lo, hi, std::back_inserter(got));
+        std::vector<int> expected;
+        for (auto it = s.lower_bound(lo); it != s.end() && *it < hi; ++it) {
+            expected.push_back(*it);
+        }
+        EXPECT_EQ(got, expected);
+    }
+}
+
+TYPED_TEST(BackendMap, ForEachInRangeCanModify) {
+    TypeParam m;
+    for (int i = 0; i < 100; i++) {
+        m[i] = i;
+    }
+    int visited = 0;
+    m.for_each_in_range(10, 20, [&](auto &value) {
+        EXPECT_EQ(value.first, 10 + visited++);
+        value.second = -1;
+    });
+    EXPECT_EQ(visited, 10);
+    EXPECT_EQ(m.find(9)->second, 9);
+    EXPECT_EQ(m.find(10)->second, -1);
+    EXPECT_EQ(m.find(19)->second, -1);
+    EXPECT_EQ(m.find(20)->second, 20);
+}
+
+TYPED_TEST(BackendMap, EraseToEmptyAndReuse) {
+    TypeParam m;
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 50; i++) {
+            m.insert(std::make_pair(i, round));
+        }
+        for (auto it = m.begin(); it != m.end(); ) {
+            it = m.erase(it);
+        }
+        EXPECT_TRUE(m.empty());
+        EXPECT_EQ(m.begin(), m.end());
+    }
+}
+
+TYPED_TEST(BackendMap, CopyIsDeep) {
+    TypeParam m;
+    for (int i = 0; i < 100; i++) {
+        m[i] = i;
+    }
+    TypeParam copy(m);
+    EXPECT_EQ(copy.shape().depth_histogram, m.shape().depth_histogram);
+    copy[0] = -1;
+    copy.erase(50);
+    EXPECT_EQ(m.size(), 100);
+    EXPECT_EQ(m.find(0)->second, 0);
+    EXPECT_NE(m.find(50), m.end());
+    EXPECT_EQ(copy.size(), 99);
+    m = copy;
+    EXPECT_EQ(m.size(), 99);
+    EXPECT_EQ(m.find(0)->second, -1);
+    int i = 0;
+    for (auto it = m.begin(); it != m.end(); ++it, ++i) {
+        i += i == 50;
+        EXPECT_EQ(it->first, i);
+    }
+    // Both still grow independently
+    m[1000] = 0;
+    copy[2000] = 0;
+    EXPECT_EQ(m.count(2000), 0);
+    EXPECT_EQ(copy.count(1000), 0);
+}
+
+TYPED_TEST(BackendMap, MoveKeepsIterators) {
+    TypeParam m;
+    for (int i = 0; i < 100; i++) {
+        m[i] = i;
+    }
+    auto it = m.find(42);
+    TypeParam moved(std::move(m));
+    EXPECT_EQ(moved.size(), 100);
+    EXPECT_EQ(it, moved.find(42));
+    EXPECT_EQ(std::next(moved.find(99)), moved.end());
+    EXPECT_EQ(moved.begin()->first, 0);
+
+    TypeParam empty;
+    moved = std::move(empty);
+    EXPECT_TRUE(moved.empty());
+    EXPECT_EQ(moved.begin(), moved.end());
+    moved[1] = 1;
+    EXPECT_EQ(moved.size(), 1);
+}
+
+// Big enough that the nodes put their links first
+using large_value = std::array<int, 32>;
+
+static_assert(bst::impl::links_first<int, large_value>);
+static_assert(!bst::impl::links_first<int, int>);
+
+// Rotations read the balancing data along with the links, so it has to come
+// before a large record as well
+TEST(LargeValueNode, BalancingDataComesBeforeTheRecord) {
+    const std::pair<const int, large_value> value{};
+    const auto before_record = [](const auto &n, const void *field) {
+        const auto *record = reinterpret_cast<const char *>(&n.record);
+        return reinterpret_cast<const char *>(&n.left) < record && static_cast<const char *>(field) < record;
+    };
+    const bst::impl::treap_node<int, large_value> treap(value, nullptr);
+    EXPECT_TRUE(before_record(treap, &treap.pri));
+    EXPECT_TRUE(before_record(treap, &treap.size));
+    const bst::impl::treap_node<int, large_value, false, false, true> prioritized(value, nullptr);
+    EXPECT_TRUE(before_record(prioritized, &prioritized.max_pri));
+    const bst::impl::avl_node<int, large_value> avl(value, nullptr);
+    EXPECT_TRUE(before_record(avl, &avl.height));
+    const bst::impl::rb_node<int, large_value> rb(value, nullptr);
+    EXPECT_TRUE(before_record(rb, &rb.red));
+    // Small records stay in front
+    const bst::impl::avl_node<int, int> small(std::pair<const int, int>{}, nullptr);
+    EXPECT_LT(static_cast<const void *>(&small.record), static_cast<const void *>(&small.left));
+}
+
+template<class Map>
+class LargeValueMap : public testing::Test {};
+
+using large_value_map_types = testing::Types<bst::treap_map<int, large_value>, bst::avl_map<int, large_value>,
+                                             bst::rb_map<int, large_value>, bst::scapegoat_map<int, large_value>,
+                                             bst::multimap<int, large_value>>;
+
+TYPED_TEST_SUITE(LargeValueMap, large_value_map_types);
+
+TYPED_TEST(LargeValueMap, RandomAgainstStdMap) {
+    TypeParam m;
+    std::map<int, large_value> ref;
+    std::minstd_rand g;
+    for (int i = 0; i < 5000; i++) {
+        const int key = static_cast<int>(g() % 500);
+        if (g() % 3 == 0) {
+            EXPECT_EQ(m.erase(key), ref.erase(key));
+        } else if (m.find(key) == m.end()) {
+            large_value value{};
+            value.fill(i);
+            m.insert(std::make_pair(key, value));
+            ref.insert(std::make_pair(key, value));
+        }
+    }
+    ASSERT_EQ(m.size(), ref.size());
+    auto it = m.begin();
+    for (const auto &[key, value] : ref) {
+        EXPECT_EQ(it->first, key);
+        EXPECT_EQ(it->second, value);
+        ++it;
+    }
+    EXPECT_EQ(it, m.end());
+}
+
+}
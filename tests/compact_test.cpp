@@ -0,0 +1,209 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#include <cstdint> // std::uintptr_t, UINTPTR_MAX
+
+#include <algorithm>  // std::max, std::min
+#include <functional> // std::less
+#include <iterator>   // std::prev
+#include <map>        // std::map
+#include <random>     // std::minstd_rand
+#include <stdexcept>  // std::runtime_error
+#include <string>     // std::string, std::to_string
+#include <utility>    // std::make_pair, std::pair
+
+#include <gtest/gtest.h>
+
+#include "../src/bst.h"
+#include "../src/stats_alloc.h"
+
+namespace {
+
+template<class Map>
+class Compact : public testing::Test {};
+
+using map_types = testing::Types<bst::treap_map<int, int>, bst::avl_map<int, int>, bst::rb_map<int, int>,
+                                 bst::scapegoat_map<int, int>, bst::multimap<int, int>, bst::adaptive_map<int, int>>;
+
+TYPED_TEST_SUITE(Compact, map_types);
+
+template<class Map>
+void expect_same(Map &m, const std::map<int, int> &ref) {
+    ASSERT_EQ(m.size(), ref.size());
+    auto it = m.begin();
+    for (const auto &value : ref) {
+        EXPECT_EQ(it->first, value.first);
+        EXPECT_EQ(it->second, value.second);
+        ++it;
+    }
+    EXPECT_EQ(it, m.end());
+}
+
+TYPED_TEST(Compact, KeepsContentsThroughChurn) {
+    TypeParam m;
+    std::map<int, int> ref;
+    std::minstd_rand g(12345);
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < 500; i++) {
+            const int key = static_cast<int>(g() % 2000);
+            if (g() % 3 == 0) {
+                m.erase_range(key, key + 1);
+                ref.erase(key);
+            } else if (m.find(key) == m.end()) {
+                m.insert(std::make_pair(key, i));
+                ref.insert(std::make_pair(key, i));
+            }
+        }
+        const auto shape = m.shape();
+        m.compact();
+        EXPECT_EQ(m.shape().height, shape.height);
+        expect_same(m, ref);
+        if (!ref.empty()) {
+            EXPECT_EQ(m.find(ref.begin()->first)->second, ref.begin()->second);
+            EXPECT_EQ(std::prev(m.end())->first, ref.rbegin()->first);
+        }
+    }
+    m.clear();
+    m.compact();
+    EXPECT_TRUE(m.empty());
+}
+
+TEST(Compact, LaysNodesOutInOneBlock) {
+    struct block_tag {};
+    using alloc = bst::stats_allocator<std::pair<const int, int>, block_tag>;
+    {
+        bst::treap_map<int, int, std::less<int>, alloc> m;
+        std::minstd_rand g(12345);
+        for (int i = 0; i < 1000; i++) {
+            m[static_cast<int>(g() % 100000)] = i;
+        }
+        const auto size = m.size();
+        const auto node_bytes = alloc::stats().live_bytes / size;
+        m.compact();
+        EXPECT_EQ(alloc::stats().allocations, size + 2); // The block and its bookkeeping
+        EXPECT_GE(alloc::stats().live_bytes, size * node_bytes);
+        EXPECT_LT(alloc::stats().live_bytes, size * node_bytes + node_bytes);
+
+        // The root comes first and every other node follows within the block
+        std::uintptr_t lowest = UINTPTR_MAX;
+        std::uintptr_t highest = 0;
+        for (const auto &value : m) {
+            const auto address = reinterpret_cast<std::uintptr_t>(&value);
+            lowest = std::min(lowest, address);
+            highest = std::max(highest, address);
+        }
+        EXPECT_EQ(highest - lowest, (size - 1) * node_bytes);
+
+        // Still a normal tree: new nodes on their own, erased slots kept
+        m[-1] = -1;
+        EXPECT_EQ(m.erase(-1), 1);
+        m.erase(m.begin());
+        EXPECT_EQ(alloc::stats().allocations - alloc::stats().deallocations, 2);
+    }
+    EXPECT_EQ(alloc::stats().live_bytes, 0);
+}
+
+TEST(Compact, BlockOutlivesTheTreeWhileShared) {
+    struct shared_tag {};
+    using alloc = bst::stats_allocator<std::pair<const int, int>, shared_tag>;
+    {
+        // Declared first so that it runs what is left to free before it goes
+        bst::thread_pool pool(2);
+        bst::treap_map<int, int, std::less<int>, alloc> rest;
+        {
+            bst::treap_map<int, int, std::less<int>, alloc> m;
+            for (int i = 0; i < 1000; i++) {
+                m[i] = i;
+            }
+            m.compact();
+            rest = m.extract_range(m.lower_bound(200), m.lower_bound(700));
+            EXPECT_EQ(m.size(), 500);
+        }
+        EXPECT_GT(alloc::stats().live_bytes, 0);
+        ASSERT_EQ(rest.size(), 500);
+        EXPECT_EQ(rest.begin()->first, 200);
+        rest.compact();
+        EXPECT_EQ(rest.erase_range(0, 300), 100);
+
+        bst::treap_map<int, int, std::less<int>, alloc> other;
+        other[0] = 0;
+        other.swap(rest);
+        EXPECT_EQ(other.size(), 400);
+        rest.compact();
+        other.clear_async(pool);
+    }
+    EXPECT_EQ(alloc::stats().live_bytes, 0);
+}
+
+TEST(Compact, BlockGoesWithItsLastNode) {
+    struct last_tag {};
+    using alloc = bst::stats_allocator<std::pair<const int, int>, last_tag>;
+    bst::treap_map<int, int, std::less<int>, alloc> m;
+    for (int i = 0; i < 1000; i++) {
+        m[i] = i;
+    }
+    m.compact();
+    m[1000] = 1000;
+    while (m.size() > 1) {
+        m.erase(m.begin());
+    }
+    EXPECT_GT(alloc::stats().live_bytes, 0);
+    m.erase(m.begin());
+    EXPECT_EQ(alloc::stats().live_bytes, 0);
+
+    // Shared, it stays until neither tree has any of it left
+    for (int i = 0; i < 1000; i++) {
+        m[i] = i;
+    }
+    m.compact();
+    auto rest = m.extract_range(m.lower_bound(500), m.end());
+    EXPECT_EQ(m.erase_range(0, 500), 500);
+    EXPECT_GT(alloc::stats().live_bytes, 0);
+    auto all = rest.extract_range(rest.begin(), rest.end());
+    EXPECT_GT(alloc::stats().live_bytes, 0);
+    EXPECT_EQ(all.erase_range(0, 1000), 500);
+    EXPECT_EQ(alloc::stats().live_bytes, 0);
+}
+
+// Copies are made when moving could throw, and can throw themselves
+struct fragile {
+    fragile() = default;
+
+    explicit fragile(std::string s) : s(std::move(s)) {}
+
+    fragile(const fragile &other) : s(other.s) {
+        if (s == "throws" && armed) {
+            throw std::runtime_error("copy");
+        }
+    }
+
+    fragile(fragile &&other) : s(std::move(other.s)) {} // NOLINT(performance-noexcept-move-constructor)
+
+    fragile &operator=(const fragile &) = default;
+
+    bool operator<(const fragile &other) const {
+        return s < other.s;
+    }
+
+    std::string s;
+    inline static bool armed = false;
+};
+
+TEST(Compact, LeavesTheTreeAsItWasIfACopyThrows) {
+    bst::treap_map<fragile, int> m;
+    for (int i = 0; i < 100; i++) {
+        m.insert(std::make_pair(fragile(std::to_string(i)), i));
+    }
+    m.insert(std::make_pair(fragile("throws"), 100));
+    fragile::armed = true;
+    EXPECT_THROW(m.compact(), std::runtime_error);
+    fragile::armed = false;
+    EXPECT_EQ(m.size(), 101);
+    EXPECT_EQ(m.find(fragile("throws"))->second, 100);
+    EXPECT_EQ(m.find(fragile("42"))->second, 42);
+    m.compact();
+    EXPECT_EQ(m.find(fragile("throws"))->second, 100);
+}
+
+}
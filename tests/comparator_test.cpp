@@ -0,0 +1,186 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+// Also built as C++20, where the three-way comparator tests are enabled
+
+#include <cctype> // std::tolower
+
+#include <algorithm>   // std::lexicographical_compare
+#include <functional>  // std::greater, std::less
+#include <map>         // std::map
+#include <random>      // std::minstd_rand
+#include <string>      // std::string
+#include <type_traits> // std::remove_const_t
+#include <utility>     // std::make_pair, std::move
+#if __cplusplus > 201703L
+#include <compare>   // std::compare_three_way, std::weak_ordering
+#endif
+
+#include <gtest/gtest.h>
+
+#include "../src/bst.h"
+
+namespace {
+
+// Order picked at runtime, which needs the comparator to be stored
+struct runtime_order {
+    bool descending = false;
+
+    bool operator()(int lhs, int rhs) const {
+        return descending ? rhs < lhs : lhs < rhs;
+    }
+};
+
+// Equivalent keys that aren't ==
+struct case_insensitive_less {
+    bool operator()(const std::string &lhs, const std::string &rhs) const {
+        return std::lexicographical_compare(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](char a, char b) {
+            return std::tolower(static_cast<unsigned char>(a)) < std::tolower(static_cast<unsigned char>(b));
+        });
+    }
+};
+
+template<class Map>
+class StoredComparator : public testing::Test {};
+
+using map_types = testing::Types<bst::treap_map<int, int, runtime_order>, bst::avl_map<int, int, runtime_order>,
+                                 bst::rb_map<int, int, runtime_order>, bst::scapegoat_map<int, int, runtime_order>,
+                                 bst::multimap<int, int, runtime_order>>;
+
+TYPED_TEST_SUITE(StoredComparator, map_types);
+
+TYPED_TEST(StoredComparator, RuntimeOrder) {
+    TypeParam m(runtime_order{true});
+    for (int i = 0; i < 100; i++) {
+        m.insert(std::make_pair(i, i));
+    }
+    EXPECT_TRUE(m.key_comp().descending);
+    int expected = 99;
+    for (auto it = m.begin(); it != m.end(); ++it) {
+        EXPECT_EQ(it->first, expected--);
+    }
+    EXPECT_EQ(m.lower_bound(50)->first, 50);
+    EXPECT_EQ(m.upper_bound(50)->first, 49);
+    EXPECT_EQ(m.erase_range(60, 40), 20);
+
+    // Copies and moves keep the comparator
+    TypeParam copy(m);
+    copy.insert(std::make_pair(1000, 0));
+    EXPECT_EQ(copy.begin()->first, 1000);
+    TypeParam moved(std::move(copy));
+    EXPECT_TRUE(moved.key_comp().descending);
+}
+
+static_assert(bst::impl::branchless_keys<double, std::greater<>>);
+static_assert(!bst::impl::branchless_keys<int, runtime_order>);
+static_assert(!bst::impl::branchless_keys<std::string, std::less<std::string>>);
+
+// Arithmetic keys in their natural order take the branchless descent
+template<class Map>
+class BranchlessKeys : public testing::Test {};
+
+using branchless_types = testing::Types<bst::treap_map<double, int, std::greater<double>>,
+                                        bst::avl_map<unsigned long long, int, std::greater<>>,
+                                        bst::rb_map<char, int, std::less<>>,
+                                        bst::multimap<long, int>>;
+
+TYPED_TEST_SUITE(BranchlessKeys, branchless_types);
+
+TYPED_TEST(BranchlessKeys, BoundsAgainstStdMap) {
+    using key_type = std::remove_const_t<typename TypeParam::value_type::first_type>;
+    TypeParam m;
+    std::map<key_type, int, typename TypeParam::key_compare> ref;
+    std::minstd_rand g;
+    for (int i = 0; i < 100; i++) {
+        const auto key = static_cast<key_type>(g() % 100);
+        m.insert(std::make_pair(key, i));
+        ref.insert(std::make_pair(key, i));
+    }
+    for (int i = 0; i < 120; i++) {
+        const auto key = static_cast<key_type>(i);
+        auto lo = m.lower_bound(key);
+        auto hi = m.upper_bound(key);
+        ASSERT_EQ(lo == m.end(), ref.lower_bound(key) == ref.end());
+        ASSERT_EQ(hi == m.end(), ref.upper_bound(key) == ref.end());
+        if (lo != m.end()) {
+            EXPECT_EQ(lo->first, ref.lower_bound(key)->first);
+        }
+        if (hi != m.end()) {
+            EXPECT_EQ(hi->first, ref.upper_bound(key)->first);
+        }
+        EXPECT_EQ(m.find(key) != m.end(), ref.count(key) != 0);
+    }
+}
+
+TEST(StoredComparator, EquivalenceIsNotEquality) {
+    bst::map<std::string, int, case_insensitive_less> m;
+    m["Hello"] = 1;
+    EXPECT_FALSE(m.insert(std::make_pair("HELLO", 2)).second);
+    EXPECT_EQ(m.size(), 1);
+    ASSERT_NE(m.find("hello"), m.end());
+    EXPECT_EQ(m.find("hello")->second, 1);
+    EXPECT_EQ(m.count("hELLo"), 1);
+    EXPECT_EQ(m.erase("HELLO"), 1);
+    EXPECT_TRUE(m.empty());
+}
+
+#if __cpp_lib_three_way_comparison >= 201907L
+struct case_insensitive_three_way {
+    std::weak_ordering operator()(const std::string &lhs, const std::string &rhs) const {
+        for (std::size_t i = 0; i < lhs.size() && i < rhs.size(); i++) {
+            const int a = std::tolower(static_cast<unsigned char>(lhs[i]));
+            const int b = std::tolower(static_cast<unsigned char>(rhs[i]));
+            if (a != b) {
+                return a <=> b;
+            }
+        }
+        return lhs.size() <=> rhs.size();
+    }
+};
+
+static_assert(bst::impl::is_three_way<std::compare_three_way, int>);
+static_assert(!bst::impl::is_three_way<std::less<int>, int>);
+
+TEST(ThreeWayComparator, RandomAgainstStdMap) {
+    bst::map<int, int, std::compare_three_way> m;
+    std::map<int, int> ref;
+    std::minstd_rand g;
+    for (int i = 0; i < 20000; i++) {
+        const int key = static_cast<int>(g() % 2000);
+        switch (g() % 4) {
+            case 0:
+                EXPECT_EQ(m.erase(key), ref.erase(key));
+                break;
+            case 1:
+                EXPECT_EQ(m.insert(std::make_pair(key, i)).second, ref.insert(std::make_pair(key, i)).second);
+                break;
+            case 2:
+                EXPECT_EQ(m.lower_bound(key) == m.end(), ref.lower_bound(key) == ref.end());
+                break;
+            default:
+                EXPECT_EQ(m.find(key) == m.end(), ref.find(key) == ref.end());
+        }
+    }
+    auto it = m.begin();
+    for (const auto &[key, value] : ref) {
+        EXPECT_EQ(it->first, key);
+        EXPECT_EQ(it->second, value);
+        ++it;
+    }
+}
+
+TEST(ThreeWayComparator, EquivalentStrings) {
+    bst::multimap<std::string, int, case_insensitive_three_way> m;
+    m.insert(std::make_pair("abc", 1));
+    m.insert(std::make_pair("ABC", 2));
+    m.insert(std::make_pair("abd", 3));
+    EXPECT_EQ(m.count("aBc"), 2);
+    EXPECT_EQ(m.lower_bound("ABD")->second, 3);
+    EXPECT_EQ(m.find("ABD")->second, 3);
+    EXPECT_EQ(m.erase("abc"), 2);
+    EXPECT_EQ(m.size(), 1);
+}
+#endif
+
+}
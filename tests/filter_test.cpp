@@ -0,0 +1,147 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#include <map>     // std::map, std::multimap
+#include <memory>  // std::allocator
+#include <random>  // std::minstd_rand
+#include <set>     // std::set
+#include <sstream> // std::stringstream
+#include <string>  // std::string, std::to_string
+#include <utility> // std::make_pair, std::pair
+#include <vector>  // std::vector
+
+#include <gtest/gtest.h>
+
+#include "../src/bst.h"
+#include "../src/filter.h"
+
+namespace {
+
+template<class Map, class Ref>
+void expect_lookups(Map &m, const Ref &ref, int keys) {
+    ASSERT_EQ(m.size(), ref.size());
+    for (int key = 0; key < keys; key++) {
+        EXPECT_EQ(m.contains(key), ref.count(key) != 0);
+        EXPECT_EQ(m.count(key), ref.count(key));
+        EXPECT_EQ(m.find(key) == m.end(), ref.find(key) == ref.end());
+    }
+}
+
+TEST(Filter, RandomAgainstStdMap) {
+    bst::filtered_map<int, int> m;
+    std::map<int, int> ref;
+    std::minstd_rand g(12345);
+    for (int round = 0; round < 40; round++) {
+        // Grows for a while and then shrinks, so the filter is resized both ways
+        const bool growing = round < 20;
+        for (int i = 0; i < 500; i++) {
+            const int key = static_cast<int>(g() % 20000);
+            if (g() % 4 == 0 || !growing) {
+                EXPECT_EQ(m.erase(key), ref.erase(key));
+                if (!growing) {
+                    const int lo = static_cast<int>(g() % 20000);
+                    m.erase_range(lo, lo + 20);
+                    ref.erase(ref.lower_bound(lo), ref.lower_bound(lo + 20));
+                }
+            } else {
+                m.insert(std::make_pair(key, i));
+                ref.insert(std::make_pair(key, i));
+            }
+        }
+        expect_lookups(m, ref, 20000);
+    }
+}
+
+TEST(Filter, NodesMovedOrRebuiltKeepTheFilterRight) {
+    bst::filtered_map<int, int> m;
+    std::map<int, int> ref;
+    std::vector<std::pair<int, int>> batch;
+    for (int i = 0; i < 3000; i++) {
+        batch.emplace_back(i * 7 % 5000, i);
+    }
+    m.insert_bulk(batch.begin(), batch.end(), 64);
+    ref.insert(batch.begin(), batch.end());
+    expect_lookups(m, ref, 5000);
+
+    auto extracted = m.extract_range(m.lower_bound(1000), m.lower_bound(2000));
+    std::map<int, int> extracted_ref(ref.lower_bound(1000), ref.lower_bound(2000));
+    ref.erase(ref.lower_bound(1000), ref.lower_bound(2000));
+    // Erased before the extracted treap has looked anything up
+    EXPECT_EQ(extracted.erase(1001), extracted_ref.erase(1001));
+    expect_lookups(m, ref, 5000);
+    expect_lookups(extracted, extracted_ref, 5000);
+
+    auto copy = m;
+    copy.erase(7);
+    expect_lookups(m, ref, 5000);
+    m.compact();
+    expect_lookups(m, ref, 5000);
+
+    std::stringstream snapshot;
+    m.save(snapshot);
+    bst::filtered_map<int, int> loaded;
+    loaded.load(snapshot);
+    expect_lookups(loaded, ref, 5000);
+
+    m.swap(extracted);
+    expect_lookups(m, extracted_ref, 5000);
+    m.clear();
+    expect_lookups(m, std::map<int, int>(), 5000);
+    extracted.clear_async();
+    extracted[3] = 3;
+    EXPECT_TRUE(extracted.contains(3));
+    EXPECT_FALSE(extracted.contains(4));
+}
+
+TEST(Filter, MultiAndStringKeys) {
+    bst::impl::treap<int, int, std::less<int>, std::allocator<std::pair<const int, int>>, false, true, false, false,
+                     false, true> m;
+    std::multimap<int, int> ref;
+    std::minstd_rand g(12345);
+    for (int i = 0; i < 3000; i++) {
+        // Enough duplicates of some keys to saturate their counters
+        const int key = static_cast<int>(g() % 2 == 0 ? g() % 4 : g() % 3000);
+        if (g() % 3 == 0) {
+            EXPECT_EQ(m.erase(key), ref.erase(key));
+        } else {
+            m.insert(std::make_pair(key, i));
+            ref.insert(std::make_pair(key, i));
+        }
+    }
+    expect_lookups(m, ref, 3000);
+
+    bst::filtered_set<std::string> s;
+    std::set<std::string> string_ref;
+    for (int i = 0; i < 1000; i += 3) {
+        s.insert(std::to_string(i));
+        string_ref.insert(std::to_string(i));
+    }
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ(s.contains(std::to_string(i)), string_ref.count(std::to_string(i)) != 0);
+    }
+}
+
+TEST(Filter, FalsePositivesAndRemoval) {
+    bst::impl::counting_filter<int, std::allocator<int>> filter;
+    EXPECT_TRUE(filter.may_contain(1));
+    filter.reset(10000);
+    EXPECT_GE(filter.capacity(), 10000);
+    for (int i = 0; i < 10000; i++) {
+        filter.add(2 * i);
+    }
+    int false_positives = 0;
+    for (int i = 0; i < 100000; i++) {
+        EXPECT_TRUE(filter.may_contain(2 * (i % 10000)));
+        false_positives += filter.may_contain(2 * i + 1);
+    }
+    EXPECT_LT(false_positives, 100000 / 20);
+    for (int i = 0; i < 10000; i++) {
+        filter.remove(2 * i);
+    }
+    for (int i = 0; i < 20000; i++) {
+        EXPECT_FALSE(filter.may_contain(i));
+    }
+}
+
+}
@@ -0,0 +1,183 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#include <cstddef> // std::size_t
+
+#include <iterator> // std::distance
+#include <map>      // std::map
+#include <memory>   // std::allocator
+#include <random>   // std::minstd_rand
+#include <sstream>  // std::stringstream
+#include <string>   // std::string, std::to_string
+#include <utility>  // std::make_pair, std::pair
+#include <vector>   // std::vector
+
+#include <gtest/gtest.h>
+
+#include "../src/bst.h"
+#include "../src/hash_index.h"
+
+namespace {
+
+template<class Map, class Ref>
+void expect_same(Map &m, const Ref &ref, int keys) {
+    ASSERT_EQ(m.size(), ref.size());
+    for (int key = 0; key < keys; key++) {
+        const auto it = ref.find(key);
+        auto found = m.find(key);
+        ASSERT_EQ(found == m.end(), it == ref.end());
+        if (it != ref.end()) {
+            EXPECT_EQ(found->first, key);
+            EXPECT_EQ(found->second, it->second);
+        }
+        EXPECT_EQ(m.contains(key), it != ref.end());
+    }
+    auto it = m.begin();
+    for (const auto &value : ref) {
+        EXPECT_EQ(it->first, value.first);
+        ++it;
+    }
+    EXPECT_EQ(it, m.end());
+}
+
+TEST(Indexed, RandomAgainstStdMap) {
+    bst::indexed_map<int, int> m;
+    std::map<int, int> ref;
+    std::minstd_rand g(12345);
+    for (int i = 0; i < 20000; i++) {
+        const int key = static_cast<int>(g() % 3000);
+        switch (g() % 5) {
+            case 0:
+                EXPECT_EQ(m.erase(key), ref.erase(key));
+                break;
+            case 1:
+                if (auto it = m.lower_bound(key); it != m.end()) {
+                    ref.erase(it->first);
+                    m.erase(it);
+                }
+                break;
+            case 2:
+                m[key] += i;
+                ref[key] += i;
+                break;
+            default:
+                EXPECT_EQ(m.insert(std::make_pair(key, i)).second, ref.insert(std::make_pair(key, i)).second);
+        }
+        if (i % 1000 == 0) {
+            expect_same(m, ref, 3000);
+        }
+    }
+    expect_same(m, ref, 3000);
+}
+
+TEST(Indexed, NodesMovedOrRebuiltStayIndexed) {
+    bst::indexed_map<int, int> m;
+    std::map<int, int> ref;
+    std::vector<std::pair<int, int>> batch;
+    for (int i = 0; i < 3000; i++) {
+        batch.emplace_back(i * 7 % 5000, i);
+    }
+    m[7] = -1;
+    ref[7] = -1;
+    // Duplicates of keys in the batch and in the map are made and then freed
+    m.insert_bulk(batch.begin(), batch.end(), 64);
+    ref.insert(batch.begin(), batch.end());
+    expect_same(m, ref, 5000);
+
+    EXPECT_EQ(m.erase_range(100, 400),
+              static_cast<std::size_t>(std::distance(ref.lower_bound(100), ref.lower_bound(400))));
+    ref.erase(ref.lower_bound(100), ref.lower_bound(400));
+    auto extracted = m.extract_range(m.lower_bound(1000), m.lower_bound(2000));
+    std::map<int, int> extracted_ref(ref.lower_bound(1000), ref.lower_bound(2000));
+    ref.erase(ref.lower_bound(1000), ref.lower_bound(2000));
+    expect_same(m, ref, 5000);
+    expect_same(extracted, extracted_ref, 5000);
+
+    m.compact();
+    expect_same(m, ref, 5000);
+    auto copy = m;
+    copy.erase(3);
+    expect_same(m, ref, 5000);
+
+    std::stringstream snapshot;
+    m.save(snapshot);
+    bst::indexed_map<int, int> loaded;
+    loaded[-1] = -1;
+    loaded.load(snapshot);
+    expect_same(loaded, ref, 5000);
+
+    m.swap(extracted);
+    expect_same(m, extracted_ref, 5000);
+    expect_same(extracted, ref, 5000);
+    m.clear();
+    expect_same(m, std::map<int, int>(), 5000);
+    m[4] = 4;
+    EXPECT_EQ(m.find(4)->second, 4);
+    EXPECT_GT(m.memory_usage(), sizeof(m) + sizeof(*m.begin()));
+}
+
+TEST(Indexed, StringKeys) {
+    bst::indexed_map<std::string, int> m;
+    for (int i = 0; i < 1000; i++) {
+        m[std::to_string(i)] = i;
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        EXPECT_EQ(m.erase(std::to_string(i)), 1);
+    }
+    for (int i = 0; i < 1000; i++) {
+        const auto it = m.find(std::to_string(i));
+        ASSERT_EQ(it == m.end(), i % 2 == 0);
+        if (i % 2 != 0) {
+            EXPECT_EQ(m[std::to_string(i)], i);
+        }
+    }
+}
+
+struct fake_node {
+    [[nodiscard]] const int &key() const {
+        return k;
+    }
+
+    int k;
+};
+
+// Every key in one of two runs, so that erasing has to shift entries back
+// across the end of the table too
+struct clashing_hash {
+    std::size_t operator()(int key) const noexcept {
+        return key % 2 == 0 ? 0 : 0x12345678;
+    }
+};
+
+TEST(Indexed, EraseShiftsCollidingEntriesBack) {
+    bst::impl::hash_index<int, fake_node, std::allocator<int>, clashing_hash> index;
+    std::vector<fake_node> nodes;
+    for (int i = 0; i < 10; i++) {
+        nodes.push_back({i});
+    }
+    index.reserve(nodes.size());
+    for (fake_node &n : nodes) {
+        index.insert(&n);
+    }
+    const auto find = [&index](int key) {
+        const fake_node *n = index.find(key, [key](const fake_node *n) { return n->k == key; });
+        return n != nullptr ? n->k : -1;
+    };
+    std::minstd_rand g(12345);
+    std::vector<bool> erased(nodes.size());
+    for (int round = 0; round < 10; round++) {
+        int victim;
+        do {
+            victim = static_cast<int>(g() % nodes.size());
+        } while (erased[victim]);
+        index.erase(&nodes[victim]);
+        erased[victim] = true;
+        for (int key = 0; key < static_cast<int>(nodes.size()); key++) {
+            EXPECT_EQ(find(key), erased[key] ? -1 : key);
+        }
+    }
+    EXPECT_EQ(index.size(), 0);
+}
+
+}
@@ -0,0 +1,135 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#include <algorithm> // std::max, std::min
+#include <map>       // std::map, std::multimap
+#include <random>    // std::minstd_rand
+#include <utility>   // std::make_pair, std::pair
+#include <vector>    // std::vector
+
+#include <gtest/gtest.h>
+
+#include "../src/bst.h"
+
+namespace {
+
+using interval = std::pair<int, int>;
+
+template<class Map>
+std::vector<interval> overlapping(Map &m, int lo, int hi) {
+    std::vector<interval> res;
+    m.for_each_overlapping(lo, hi, [&res](const auto &value) { res.emplace_back(value.first, value.second); });
+    return res;
+}
+
+template<class Ref>
+std::vector<interval> expected_overlapping(const Ref &ref, int lo, int hi) {
+    std::vector<interval> res;
+    for (const auto &[start, end] : ref) {
+        if (start <= hi && end >= lo) {
+            res.emplace_back(start, end);
+        }
+    }
+    return res;
+}
+
+template<class Map, class Ref>
+void expect_queries(Map &m, const Ref &ref, std::minstd_rand &g) {
+    for (int i = 0; i < 20; i++) {
+        const int a = static_cast<int>(g() % 11000);
+        const int b = a + static_cast<int>(g() % 200);
+        const auto expected = expected_overlapping(ref, a, b);
+        EXPECT_EQ(overlapping(m, a, b), expected);
+        EXPECT_EQ(m.overlaps(a, b), !expected.empty());
+        std::vector<interval> stabbed;
+        m.for_each_containing(a, [&stabbed](const auto &value) { stabbed.emplace_back(value.first, value.second); });
+        EXPECT_EQ(stabbed, expected_overlapping(ref, a, a));
+    }
+}
+
+TEST(Interval, RandomAgainstBruteForce) {
+    bst::interval_map<int> m;
+    std::map<int, int> ref;
+    std::minstd_rand g;
+    for (int i = 0; i < 4000; i++) {
+        const int start = static_cast<int>(g() % 10000);
+        if (g() % 3 == 0) {
+            EXPECT_EQ(m.erase(start), ref.erase(start));
+        } else {
+            const int end = start + static_cast<int>(g() % (g() % 10 == 0 ? 1000 : 50));
+            EXPECT_EQ(m.insert(std::make_pair(start, end)).second, ref.insert(std::make_pair(start, end)).second);
+        }
+        if (i % 100 == 0) {
+            expect_queries(m, ref, g);
+        }
+    }
+    ASSERT_EQ(m.size(), ref.size());
+    expect_queries(m, ref, g);
+}
+
+TEST(Interval, RangeOperationsKeepTheEnds) {
+    bst::interval_map<int> m;
+    std::map<int, int> ref;
+    std::minstd_rand g;
+    std::vector<interval> batch;
+    for (int i = 0; i < 3000; i++) {
+        const int start = static_cast<int>(g() % 10000);
+        batch.emplace_back(start, start + static_cast<int>(g() % 300));
+    }
+    m.insert_bulk(batch.begin(), batch.begin() + 1000);
+    m.insert_bulk(batch.begin() + 1000, batch.end(), 64);
+    for (const auto &value : batch) {
+        ref.insert(value);
+    }
+    ASSERT_EQ(m.size(), ref.size());
+    expect_queries(m, ref, g);
+
+    m.erase_range(2000, 4000);
+    ref.erase(ref.lower_bound(2000), ref.lower_bound(4000));
+    expect_queries(m, ref, g);
+
+    auto extracted = m.extract_range(m.lower_bound(6000), m.lower_bound(8000));
+    std::map<int, int> extracted_ref(ref.lower_bound(6000), ref.lower_bound(8000));
+    ref.erase(ref.lower_bound(6000), ref.lower_bound(8000));
+    expect_queries(m, ref, g);
+    expect_queries(extracted, extracted_ref, g);
+}
+
+TEST(Interval, ParallelTransformKeepsTheEnds) {
+    bst::interval_multimap<int> m;
+    std::multimap<int, int> ref;
+    for (int i = 0; i < 100; i++) {
+        m.insert(interval{10 * i, 10 * i + 1});
+    }
+    m.parallel_transform([](const interval &value) { return value.first + 2000; }, 8);
+    for (const auto &value : m) {
+        ref.insert(value);
+    }
+    EXPECT_EQ(overlapping(m, 2000, 2000).size(), 100);
+    std::minstd_rand g;
+    expect_queries(m, ref, g);
+}
+
+TEST(Interval, MultiAndEdges) {
+    bst::interval_multimap<int> m;
+    std::multimap<int, int> ref;
+    for (const auto &value : {interval{5, 10}, interval{5, 5}, interval{5, 20}, interval{0, 4}, interval{11, 11}}) {
+        m.insert(value);
+        ref.insert(value);
+    }
+    // Closed intervals: the ends count
+    EXPECT_EQ(overlapping(m, 10, 10), expected_overlapping(ref, 10, 10));
+    EXPECT_EQ(overlapping(m, 10, 10).size(), 2);
+    EXPECT_EQ(overlapping(m, 4, 5).size(), 4);
+    EXPECT_FALSE(m.overlaps(21, 30));
+    EXPECT_EQ(m.erase(5), 3);
+    EXPECT_FALSE(m.overlaps(12, 30));
+    EXPECT_TRUE(m.overlaps(11, 30));
+
+    bst::interval_map<int> empty;
+    EXPECT_FALSE(empty.overlaps(0, 100));
+    EXPECT_TRUE(overlapping(empty, 0, 100).empty());
+}
+
+}
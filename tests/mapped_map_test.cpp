@@ -0,0 +1,141 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#include <cstdio> // std::remove
+
+#include <filesystem> // std::filesystem::temp_directory_path
+#include <iterator>   // std::prev
+#include <map>        // std::map
+#include <random>     // std::minstd_rand
+#include <stdexcept>  // std::runtime_error
+#include <string>     // std::string
+#include <utility>    // std::make_pair, std::move
+
+#include <gtest/gtest.h>
+
+#include "../src/mapped_map.h"
+
+namespace {
+
+class MappedMap : public testing::Test {
+protected:
+    void SetUp() override {
+        const auto *info = testing::UnitTest::GetInstance()->current_test_info();
+        path = (std::filesystem::temp_directory_path() / ("bst_" + std::string(info->name()) + ".map")).string();
+        std::remove(path.c_str());
+    }
+
+    void TearDown() override {
+        std::remove(path.c_str());
+    }
+
+    std::string path;
+};
+
+TEST_F(MappedMap, RandomAgainstStdMap) {
+    // Start small so the file has to grow and be remapped several times
+    bst::mapped_map<int, int> m(path, 4096);
+    std::map<int, int> ref;
+    std::minstd_rand g;
+    for (int i = 0; i < 20000; i++) {
+        const int key = static_cast<int>(g() % 2000);
+        if (g() % 3 == 0) {
+            EXPECT_EQ(m.erase(key), ref.erase(key));
+        } else {
+            const int value = static_cast<int>(g());
+            m[key] = value;
+            ref[key] = value;
+        }
+        EXPECT_EQ(m.size(), ref.size());
+    }
+    auto it = m.begin();
+    for (const auto &[key, value] : ref) {
+        ASSERT_NE(it, m.end());
+        EXPECT_EQ(it->first, key);
+        EXPECT_EQ(it->second, value);
+        ++it;
+    }
+    EXPECT_EQ(it, m.end());
+    for (auto rit = ref.rbegin(); rit != ref.rend(); ++rit) {
+        EXPECT_EQ((--it)->first, rit->first);
+    }
+    EXPECT_EQ(it, m.begin());
+    EXPECT_EQ(m.lower_bound(1000)->first, ref.lower_bound(1000)->first);
+    EXPECT_EQ(m.upper_bound(1000)->first, ref.upper_bound(1000)->first);
+}
+
+TEST_F(MappedMap, SurvivesReopening) {
+    {
+        bst::mapped_map<int, double> m(path, 4096);
+        for (int i = 0; i < 10000; i++) {
+            m.insert(std::make_pair(i, i * 0.5));
+        }
+        m.erase(42);
+        m.flush();
+    }
+    bst::mapped_map<int, double> m(path);
+    EXPECT_EQ(m.size(), 9999);
+    EXPECT_FALSE(m.contains(42));
+    EXPECT_EQ(m.find(43)->second, 21.5);
+    EXPECT_EQ(m.begin()->first, 0);
+    EXPECT_EQ(std::prev(m.end())->first, 9999);
+    // And keeps working
+    m[42] = 1;
+    EXPECT_EQ(m.size(), 10000);
+}
+
+TEST_F(MappedMap, ReusesErasedNodes) {
+    bst::mapped_map<int, int> m(path, 4096);
+    for (int i = 0; i < 1000; i++) {
+        m[i] = i;
+    }
+    const auto size = m.file_size();
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < 1000; i++) {
+            m.erase(i);
+        }
+        EXPECT_TRUE(m.empty());
+        EXPECT_EQ(m.begin(), m.end());
+        for (int i = 0; i < 1000; i++) {
+            m[i] = round;
+        }
+    }
+    EXPECT_EQ(m.file_size(), size);
+    EXPECT_EQ(m.find(500)->second, 9);
+}
+
+TEST_F(MappedMap, IteratorsSurviveGrowth) {
+    bst::mapped_map<int, int> m(path, 4096);
+    m[0] = 7;
+    const auto it = m.find(0);
+    for (int i = 1; i < 10000; i++) {
+        m[i] = i;
+    }
+    EXPECT_EQ(it->second, 7);
+    EXPECT_EQ(it, m.begin());
+}
+
+TEST_F(MappedMap, RejectsOtherTypes) {
+    {
+        bst::mapped_map<int, int> m(path);
+        m[1] = 1;
+    }
+    EXPECT_THROW((bst::mapped_map<int, long long>(path)), std::runtime_error);
+    EXPECT_THROW((bst::mapped_map<long long, int>(path)), std::runtime_error);
+    bst::mapped_map<int, int> m(path);
+    EXPECT_EQ(m.size(), 1);
+}
+
+TEST_F(MappedMap, MoveAndClear) {
+    bst::mapped_map<int, int> m(path);
+    m[1] = 1;
+    bst::mapped_map<int, int> moved(std::move(m));
+    EXPECT_EQ(moved.size(), 1);
+    moved.clear();
+    EXPECT_TRUE(moved.empty());
+    moved[2] = 2;
+    EXPECT_EQ(moved.begin()->first, 2);
+}
+
+}
@@ -0,0 +1,129 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#include <iterator> // std::distance, std::next
+#include <map>      // std::multimap
+#include <random>   // std::minstd_rand
+#include <set>      // std::multiset
+#include <utility>  // std::make_pair
+
+#include <gtest/gtest.h>
+
+#include "../src/bst.h"
+
+namespace {
+
+TEST(Multiset, KeepsDuplicatesInOrder) {
+    bst::multiset<int> s;
+    for (int round = 0; round < 3; round++) {
+        for (int i = 9; i >= 0; i--) {
+            s.insert(i);
+        }
+    }
+    EXPECT_EQ(s.size(), 30);
+    int i = 0;
+    for (auto it = s.begin(); it != s.end(); ++it, ++i) {
+        EXPECT_EQ(*it, i / 3);
+    }
+    for (int key = 0; key < 10; key++) {
+        EXPECT_EQ(s.count(key), 3);
+        auto [first, last] = s.equal_range(key);
+        EXPECT_EQ(std::distance(first, last), 3);
+        EXPECT_EQ(*first, key);
+    }
+    EXPECT_EQ(s.count(10), 0);
+    EXPECT_EQ(s.count(-1), 0);
+}
+
+TEST(Multimap, EqualKeysKeepInsertionOrder) {
+    bst::multimap<int, int> m;
+    for (int i = 0; i < 100; i++) {
+        m.insert(std::make_pair(i % 4, i));
+    }
+    auto it = m.begin();
+    for (int key = 0; key < 4; key++) {
+        for (int i = key; i < 100; i += 4, ++it) {
+            EXPECT_EQ(it->first, key);
+            EXPECT_EQ(it->second, i);
+        }
+    }
+    EXPECT_EQ(it, m.end());
+}
+
+TEST(Multimap, EraseKeyRemovesEveryDuplicate) {
+    bst::multimap<int, int> m;
+    for (int i = 0; i < 50; i++) {
+        m.insert(std::make_pair(i % 5, i));
+    }
+    auto keep = m.find(3);
+    EXPECT_EQ(m.erase(0), 10);
+    EXPECT_EQ(m.begin()->first, 1);
+    EXPECT_EQ(m.erase(4), 10);
+    EXPECT_EQ(std::prev(m.end())->first, 3);
+    EXPECT_EQ(m.erase(4), 0);
+    EXPECT_EQ(m.size(), 30);
+    EXPECT_EQ(keep->first, 3);
+    EXPECT_EQ(std::distance(keep, m.end()), 10);
+    EXPECT_EQ(m.erase(1) + m.erase(2) + m.erase(3), 30);
+    EXPECT_TRUE(m.empty());
+    EXPECT_EQ(m.begin(), m.end());
+    m.insert(std::make_pair(7, 7));
+    EXPECT_EQ(m.count(7), 1);
+}
+
+TEST(Multimap, RandomAgainstStdMultimap) {
+    bst::multimap<int, int> m;
+    std::multimap<int, int> ref;
+    std::minstd_rand g;
+    for (int i = 0; i < 20000; i++) {
+        const int key = static_cast<int>(g() % 200);
+        switch (g() % 8) {
+            case 0:
+                EXPECT_EQ(m.erase(key), ref.erase(key));
+                break;
+            case 1:
+                if (auto it = m.find(key); it != m.end()) {
+                    m.erase(it);
+                    ref.erase(ref.find(key));
+                }
+                break;
+            case 2: {
+                // Hints are taken from anywhere, good or bad
+                auto hint = m.lower_bound(static_cast<int>(g() % 200));
+                auto it = m.insert(hint, std::make_pair(key, i));
+                EXPECT_EQ(it->first, key);
+                ref.insert(ref.upper_bound(key), std::make_pair(key, i));
+                break;
+            }
+            default:
+                m.insert(std::make_pair(key, i));
+                ref.insert(std::make_pair(key, i));
+        }
+        ASSERT_EQ(m.size(), ref.size());
+        EXPECT_EQ(m.count(key), ref.count(key));
+    }
+    auto it = m.begin();
+    for (const auto &[key, value] : ref) {
+        EXPECT_EQ(it->first, key);
+        ++it;
+    }
+    EXPECT_EQ(it, m.end());
+    for (int key = 0; key < 200; key++) {
+        EXPECT_EQ(m.count(key), ref.count(key));
+    }
+}
+
+TEST(Map, CountAndEqualRange) {
+    bst::map<int, int> m;
+    m[1] = 1;
+    m[3] = 3;
+    EXPECT_EQ(m.count(1), 1);
+    EXPECT_EQ(m.count(2), 0);
+    auto [first, last] = m.equal_range(2);
+    EXPECT_EQ(first, last);
+    EXPECT_EQ(first->first, 3);
+    EXPECT_EQ(std::distance(m.equal_range(3).first, m.equal_range(3).second), 1);
+}
+
+}
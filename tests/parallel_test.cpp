@@ -0,0 +1,191 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#include <cstddef> // std::size_t
+#include <cstdint> // std::int64_t
+
+#include <algorithm>  // std::equal
+#include <atomic>     // std::atomic
+#include <functional> // std::plus
+#include <iterator>   // std::prev
+#include <map>        // std::map, std::multimap
+#include <random>     // std::minstd_rand
+#include <stdexcept>  // std::runtime_error
+#include <string>     // std::string, std::to_string
+#include <utility>    // std::make_pair, std::pair
+#include <vector>     // std::vector
+
+#include <gtest/gtest.h>
+
+#include "../src/bst.h"
+
+namespace {
+
+template<class Map>
+class Parallel : public testing::Test {};
+
+using map_types = testing::Types<bst::treap_map<int, std::int64_t>, bst::avl_map<int, std::int64_t>,
+                                 bst::rb_map<int, std::int64_t>, bst::scapegoat_map<int, std::int64_t>>;
+
+TYPED_TEST_SUITE(Parallel, map_types);
+
+TYPED_TEST(Parallel, ForEachVisitsEveryElementOnce) {
+    TypeParam m;
+    for (int i = 0; i < 20000; i++) {
+        m[i] = 0;
+    }
+    std::atomic<int> visited{};
+    m.parallel_for_each([&](auto &value) {
+        value.second++;
+        visited++;
+    }, 100);
+    EXPECT_EQ(visited, 20000);
+    for (auto it = m.begin(); it != m.end(); ++it) {
+        ASSERT_EQ(it->second, 1);
+    }
+}
+
+TYPED_TEST(Parallel, ReduceAndTransform) {
+    TypeParam m;
+    for (int i = 0; i < 20000; i++) {
+        m[i] = i;
+    }
+    m.parallel_transform([](const auto &value) { return value.second * 2; }, 1000);
+    const auto sum = m.parallel_reduce(std::int64_t{1}, std::plus<>(), [](const auto &value) {
+        return value.second;
+    }, 1000);
+    EXPECT_EQ(sum, 1 + std::int64_t{19999} * 20000);
+}
+
+TEST(Parallel, ReduceKeepsKeyOrder) {
+    bst::treap_map<int, int> m;
+    std::string expected = "<";
+    for (int i = 0; i < 5000; i++) {
+        m[i] = i;
+        expected += std::to_string(i) + ",";
+    }
+    bst::thread_pool pool(4);
+    for (const std::size_t grain : {1, 7, 100, 10000}) {
+        const std::string joined = m.parallel_reduce(std::string("<"), std::plus<>(), [](const auto &value) {
+            return std::to_string(value.first) + ",";
+        }, grain, pool);
+        EXPECT_EQ(joined, expected);
+    }
+}
+
+TEST(Parallel, EmptyAndSingleThreaded) {
+    bst::treap_set<int> s;
+    EXPECT_EQ(s.parallel_reduce(42, std::plus<>(), [](int key) { return key; }), 42);
+    // Without workers, the waiting thread runs everything itself
+    bst::thread_pool pool(0);
+    for (int i = 0; i < 1000; i++) {
+        s.insert(i);
+    }
+    EXPECT_EQ(s.parallel_reduce(0, std::plus<>(), [](int key) { return key; }, 10, pool), 999 * 1000 / 2);
+}
+
+TEST(InsertBulk, MatchesRepeatedInsert) {
+    std::minstd_rand g;
+    for (const std::size_t grain : {1, 16, 4096}) {
+        bst::treap_map<int, int> m;
+        std::map<int, int> ref;
+        for (int i = 0; i < 3000; i++) {
+            const int key = static_cast<int>(g() % 10000);
+            m.insert(std::make_pair(key, i));
+            ref.insert(std::make_pair(key, i));
+        }
+        std::vector<std::pair<int, int>> batch;
+        for (int i = 0; i < 20000; i++) {
+            batch.emplace_back(static_cast<int>(g() % 20000), -i);
+        }
+        const std::size_t old_size = ref.size();
+        for (const auto &value : batch) {
+            ref.insert(value);
+        }
+        EXPECT_EQ(m.insert_bulk(batch.begin(), batch.end(), grain), ref.size() - old_size);
+        EXPECT_EQ(m.size(), ref.size());
+        auto it = m.begin();
+        for (const auto &[key, value] : ref) {
+            ASSERT_NE(it, m.end());
+            EXPECT_EQ(it->first, key);
+            EXPECT_EQ(it->second, value);
+            ++it;
+        }
+        EXPECT_EQ(it, m.end());
+        EXPECT_EQ(std::prev(m.end())->first, ref.rbegin()->first);
+        // Still a valid treap
+        for (int key = 0; key < 20000; key += 2) {
+            m.erase(key);
+            ref.erase(key);
+        }
+        EXPECT_EQ(m.size(), ref.size());
+        EXPECT_EQ(m.begin()->first, ref.begin()->first);
+    }
+}
+
+TYPED_TEST(Parallel, InsertBulkOnEveryBackend) {
+    TypeParam m;
+    m[5] = 5;
+    std::vector<std::pair<int, std::int64_t>> batch{{3, 1}, {5, 1}, {3, 2}, {1, 1}};
+    EXPECT_EQ(m.insert_bulk(batch.begin(), batch.end()), 2);
+    EXPECT_EQ(m.size(), 3);
+    EXPECT_EQ(m.find(3)->second, 1);
+    EXPECT_EQ(m.find(5)->second, 5);
+    EXPECT_EQ(m.insert_bulk(batch.begin(), batch.begin()), 0);
+}
+
+TEST(InsertBulk, MultimapKeepsDuplicates) {
+    bst::multimap<int, int> m;
+    std::multimap<int, int> ref;
+    std::minstd_rand g;
+    for (int i = 0; i < 1000; i++) {
+        const int key = static_cast<int>(g() % 300);
+        m.insert(std::make_pair(key, i));
+        ref.insert(std::make_pair(key, i));
+    }
+    std::vector<std::pair<int, int>> batch;
+    for (int i = 0; i < 5000; i++) {
+        batch.emplace_back(static_cast<int>(g() % 600), -i);
+    }
+    for (const auto &value : batch) {
+        ref.insert(value);
+    }
+    EXPECT_EQ(m.insert_bulk(batch.begin(), batch.end(), 64), batch.size());
+    ASSERT_EQ(m.size(), ref.size());
+    // Equivalent keys in insertion order, as std::multimap has them
+    EXPECT_TRUE(std::equal(m.begin(), m.end(), ref.begin(), ref.end()));
+    for (int key = 0; key < 600; key += 7) {
+        EXPECT_EQ(m.count(key), ref.count(key));
+    }
+}
+
+TEST(InsertBulk, StringSetIntoEmpty) {
+    bst::treap_set<std::string> s;
+    std::vector<std::string> batch;
+    for (int i = 999; i >= 0; i--) {
+        batch.push_back("key " + std::to_string(i % 500));
+    }
+    EXPECT_EQ(s.insert_bulk(batch.begin(), batch.end(), 8), 500);
+    EXPECT_EQ(s.size(), 500);
+    EXPECT_NE(s.find("key 123"), s.end());
+    EXPECT_EQ(*s.begin(), "key 0");
+}
+
+TEST(Parallel, ExceptionsReachTheCaller) {
+    bst::treap_map<int, int> m;
+    for (int i = 0; i < 10000; i++) {
+        m[i] = i;
+    }
+    EXPECT_THROW(m.parallel_for_each([](auto &value) {
+        if (value.first == 1234) {
+            throw std::runtime_error("1234");
+        }
+    }, 10), std::runtime_error);
+    // The pool is still usable
+    std::atomic<int> visited{};
+    m.parallel_for_each([&](auto &) { visited++; }, 10);
+    EXPECT_EQ(visited, 10000);
+}
+
+}
@@ -0,0 +1,106 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#include <functional> // std::greater
+#include <map>        // std::map, std::multimap
+#include <random>     // std::minstd_rand
+#include <string>     // std::string
+#include <utility>    // std::make_pair
+
+#include <gtest/gtest.h>
+
+#include "../src/bst.h"
+
+namespace {
+
+static_assert(bst::impl::use_key_prefix<std::string, std::less<std::string>>);
+static_assert(bst::impl::use_key_prefix<std::string, std::less<>>);
+static_assert(!bst::impl::use_key_prefix<std::string, std::greater<std::string>>);
+static_assert(!bst::impl::use_key_prefix<int, std::less<int>>);
+
+TEST(KeyPrefix, OrdersLikeTheStrings) {
+    using bst::impl::key_prefix;
+    EXPECT_EQ(key_prefix(""), 0);
+    EXPECT_EQ(key_prefix("a"), 0x6100000000000000);
+    EXPECT_EQ(key_prefix("abcdefgh"), key_prefix("abcdefghij"));
+    EXPECT_LT(key_prefix("abc"), key_prefix("abd"));
+    EXPECT_LT(key_prefix("ab"), key_prefix("ab\x01"));
+    // Bytes compare unsigned, like std::string does
+    EXPECT_LT(key_prefix("a"), key_prefix("\xff"));
+    EXPECT_LT(std::string("a"), std::string("\xff"));
+}
+
+// Keys made to tie on their prefixes: shared 8 byte stems, embedded 0s,
+// strings that are prefixes of each other, and bytes above 0x7f
+std::string random_key(std::minstd_rand &g) {
+    static const std::string stems[] = {"", "a", "ab", std::string("ab\0", 3), "abcdefgh", "abcdefghi", "\xff\xfe"};
+    std::string res = stems[g() % std::size(stems)];
+    const auto extra = g() % 4;
+    for (unsigned i = 0; i < extra; i++) {
+        const char chars[] = {'\0', 'a', 'b', '\x80', '\xff'};
+        res += chars[g() % std::size(chars)];
+    }
+    return res;
+}
+
+TEST(KeyPrefix, StringMapAgainstStdMap) {
+    bst::treap_map<std::string, int> m;
+    std::map<std::string, int> ref;
+    std::minstd_rand g;
+    for (int i = 0; i < 20000; i++) {
+        const std::string key = random_key(g);
+        switch (g() % 4) {
+            case 0:
+                EXPECT_EQ(m.erase(key), ref.erase(key));
+                break;
+            case 1:
+                EXPECT_EQ(m.insert(std::make_pair(key, i)).second, ref.insert(std::make_pair(key, i)).second);
+                break;
+            default: {
+                const bool found = m.find(key) != m.end();
+                EXPECT_EQ(found, ref.count(key) == 1);
+                auto lb = m.lower_bound(key);
+                const auto ref_lb = ref.lower_bound(key);
+                ASSERT_EQ(lb == m.end(), ref_lb == ref.end());
+                if (lb != m.end()) {
+                    EXPECT_EQ(lb->first, ref_lb->first);
+                }
+                auto ub = m.upper_bound(key);
+                const auto ref_ub = ref.upper_bound(key);
+                ASSERT_EQ(ub == m.end(), ref_ub == ref.end());
+                if (ub != m.end()) {
+                    EXPECT_EQ(ub->first, ref_ub->first);
+                }
+            }
+        }
+    }
+    auto it = m.begin();
+    for (const auto &[key, value] : ref) {
+        EXPECT_EQ(it->first, key);
+        EXPECT_EQ(it->second, value);
+        ++it;
+    }
+    EXPECT_EQ(it, m.end());
+}
+
+TEST(KeyPrefix, MultimapAndCopies) {
+    bst::multimap<std::string, int> m;
+    std::multimap<std::string, int> ref;
+    std::minstd_rand g;
+    for (int i = 0; i < 2000; i++) {
+        const std::string key = random_key(g);
+        m.insert(std::make_pair(key, i));
+        ref.insert(std::make_pair(key, i));
+    }
+    const bst::multimap<std::string, int> copy(m);
+    for (int i = 0; i < 200; i++) {
+        const std::string key = random_key(g);
+        EXPECT_EQ(m.count(key), ref.count(key));
+        EXPECT_EQ(m.erase(key), ref.erase(key));
+    }
+    EXPECT_EQ(m.size(), ref.size());
+    EXPECT_EQ(copy.size(), 2000);
+}
+
+}
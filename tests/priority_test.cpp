@@ -0,0 +1,169 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#include <map>     // std::map
+#include <random>  // std::minstd_rand
+#include <string>  // std::string
+#include <utility> // std::make_pair, std::pair
+#include <vector>  // std::vector
+
+#include <gtest/gtest.h>
+
+#include "../src/bst.h"
+
+namespace {
+
+using element = std::pair<int, int>;
+
+// The key of the best priority with a key in [lo, hi), the smallest on ties,
+// or -1 if there is none
+int expected_best(const std::map<int, int> &ref, int lo, int hi, bool max) {
+    int key = -1;
+    int best = 0;
+    for (auto it = ref.lower_bound(lo); it != ref.end() && it->first < hi; ++it) {
+        if (key == -1 || (max ? it->second > best : it->second < best)) {
+            key = it->first;
+            best = it->second;
+        }
+    }
+    return key;
+}
+
+template<class Map>
+int best(Map &m, int lo, int hi, bool max) {
+    auto it = max ? m.max_priority(lo, hi) : m.min_priority(lo, hi);
+    return it != m.end() ? it->first : -1;
+}
+
+template<class Map>
+void expect_queries(Map &m, const std::map<int, int> &ref, std::minstd_rand &g) {
+    if (ref.empty()) {
+        EXPECT_EQ(m.max_priority(), m.end());
+        EXPECT_EQ(m.min_priority(), m.end());
+    } else {
+        EXPECT_EQ(m.max_priority()->first, expected_best(ref, 0, 10000, true));
+        EXPECT_EQ(m.min_priority()->first, expected_best(ref, 0, 10000, false));
+    }
+    for (int i = 0; i < 20; i++) {
+        const int lo = static_cast<int>(g() % 10000);
+        const int hi = lo + static_cast<int>(g() % 2000);
+        EXPECT_EQ(best(m, lo, hi, true), expected_best(ref, lo, hi, true));
+        EXPECT_EQ(best(m, lo, hi, false), expected_best(ref, lo, hi, false));
+
+        const int pri = static_cast<int>(g() % 1000);
+        std::vector<element> at_least;
+        m.for_each_priority_at_least(lo, hi, pri, [&at_least](const auto &value) {
+            at_least.emplace_back(value.first, value.second);
+        });
+        std::vector<element> at_most;
+        m.for_each_priority_at_most(lo, hi, pri, [&at_most](const auto &value) {
+            at_most.emplace_back(value.first, value.second);
+        });
+        std::vector<element> expected_at_least;
+        std::vector<element> expected_at_most;
+        for (auto it = ref.lower_bound(lo); it != ref.end() && it->first < hi; ++it) {
+            if (it->second >= pri) {
+                expected_at_least.push_back(*it);
+            }
+            if (it->second <= pri) {
+                expected_at_most.push_back(*it);
+            }
+        }
+        EXPECT_EQ(at_least, expected_at_least);
+        EXPECT_EQ(at_most, expected_at_most);
+    }
+}
+
+TEST(Priority, RandomAgainstBruteForce) {
+    bst::priority_map<int, int> m;
+    std::map<int, int> ref;
+    std::minstd_rand g(12345);
+    for (int i = 0; i < 4000; i++) {
+        const int key = static_cast<int>(g() % 10000);
+        switch (g() % 4) {
+            case 0:
+                EXPECT_EQ(m.erase(key), ref.erase(key));
+                break;
+            case 1:
+                if (const auto it = m.find(key); it != m.end()) {
+                    const int pri = static_cast<int>(g() % 1000);
+                    m.set_priority(it, pri);
+                    ref[key] = pri;
+                }
+                break;
+            default: {
+                const int pri = static_cast<int>(g() % 1000);
+                EXPECT_EQ(m.insert(std::make_pair(key, pri)).second, ref.insert(std::make_pair(key, pri)).second);
+            }
+        }
+        if (i % 100 == 0) {
+            expect_queries(m, ref, g);
+        }
+    }
+    ASSERT_EQ(m.size(), ref.size());
+    expect_queries(m, ref, g);
+}
+
+TEST(Priority, RangeOperationsKeepThePriorities) {
+    bst::priority_map<int, int> m;
+    std::map<int, int> ref;
+    std::minstd_rand g(12345);
+    std::vector<element> batch;
+    for (int i = 0; i < 3000; i++) {
+        batch.emplace_back(static_cast<int>(g() % 10000), static_cast<int>(g() % 1000));
+    }
+    m.insert_bulk(batch.begin(), batch.begin() + 1000);
+    m.insert_bulk(batch.begin() + 1000, batch.end(), 64);
+    for (const auto &value : batch) {
+        ref.insert(value);
+    }
+    ASSERT_EQ(m.size(), ref.size());
+    expect_queries(m, ref, g);
+
+    m.erase_range(2000, 4000);
+    ref.erase(ref.lower_bound(2000), ref.lower_bound(4000));
+    expect_queries(m, ref, g);
+
+    auto extracted = m.extract_range(m.lower_bound(6000), m.lower_bound(8000));
+    std::map<int, int> extracted_ref(ref.lower_bound(6000), ref.lower_bound(8000));
+    ref.erase(ref.lower_bound(6000), ref.lower_bound(8000));
+    expect_queries(m, ref, g);
+    expect_queries(extracted, extracted_ref, g);
+}
+
+TEST(Priority, ParallelTransformKeepsThePriorities) {
+    bst::priority_map<int, int> m;
+    for (int i = 0; i < 100; i++) {
+        m.insert(std::make_pair(i, 1));
+    }
+    m.parallel_transform([](const element &value) { return value.first; }, 8);
+    EXPECT_EQ(m.max_priority()->first, 99);
+    EXPECT_EQ(m.min_priority()->first, 0);
+    std::map<int, int> ref(m.begin(), m.end());
+    std::minstd_rand g(12345);
+    expect_queries(m, ref, g);
+}
+
+TEST(Priority, PopsInPriorityOrder) {
+    // Timestamps that only ever grow would leave a tree ordered by them as a
+    // list, which the random balancing priorities avoid
+    bst::priority_map<std::string, long> m;
+    for (long t = 0; t < 1000; t++) {
+        m.insert(std::make_pair("task " + std::to_string(t * 7919 % 1000), t));
+    }
+    EXPECT_LT(m.shape().height, 40);
+    m.set_priority(m.find("task 0"), 5000);
+    EXPECT_EQ(m.max_priority()->first, "task 0");
+    m.erase(m.max_priority());
+    for (long t = 999; t > 0; t--) {
+        auto it = m.max_priority();
+        ASSERT_EQ(it->second, t);
+        m.erase(it);
+    }
+    EXPECT_TRUE(m.empty());
+    EXPECT_EQ(m.max_priority(), m.end());
+    EXPECT_EQ(m.max_priority("a", "z"), m.end());
+}
+
+}
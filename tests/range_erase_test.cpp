@@ -0,0 +1,135 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#include <iterator> // std::distance, std::next, std::prev
+#include <map>      // std::map, std::multimap
+#include <random>   // std::minstd_rand
+#include <utility>  // std::make_pair
+
+#include <gtest/gtest.h>
+
+#include "../src/bst.h"
+
+namespace {
+
+template<class Map>
+class RangeErase : public testing::Test {};
+
+using map_types = testing::Types<bst::treap_map<int, int>, bst::avl_map<int, int>, bst::rb_map<int, int>,
+                                 bst::scapegoat_map<int, int>, bst::multimap<int, int>>;
+
+TYPED_TEST_SUITE(RangeErase, map_types);
+
+TYPED_TEST(RangeErase, EraseRangeOfKeys) {
+    TypeParam m;
+    for (int i = 0; i < 100; i++) {
+        m.insert(std::make_pair(i, i));
+    }
+    EXPECT_EQ(m.erase_range(10, 20), 10);
+    EXPECT_EQ(m.erase_range(20, 10), 0);
+    EXPECT_EQ(m.erase_range(10, 20), 0);
+    EXPECT_EQ(m.size(), 90);
+    EXPECT_EQ(m.lower_bound(10)->first, 20);
+    EXPECT_EQ(std::prev(m.lower_bound(10))->first, 9);
+    // Prefix and suffix, which move begin() and rightmost()
+    EXPECT_EQ(m.erase_range(-5, 5), 5);
+    EXPECT_EQ(m.begin()->first, 5);
+    EXPECT_EQ(m.erase_range(90, 1000), 10);
+    EXPECT_EQ(std::prev(m.end())->first, 89);
+    EXPECT_EQ(std::distance(m.begin(), m.end()), 75);
+    EXPECT_EQ(m.erase_range(0, 1000), 75);
+    EXPECT_TRUE(m.empty());
+    EXPECT_EQ(m.begin(), m.end());
+}
+
+TYPED_TEST(RangeErase, RandomAgainstStdMap) {
+    TypeParam m;
+    std::multimap<int, int> ref;
+    std::minstd_rand g;
+    for (int round = 0; round < 300; round++) {
+        for (int i = 0; i < 20; i++) {
+            const int key = static_cast<int>(g() % 500);
+            if (m.find(key) == m.end()) {
+                m.insert(std::make_pair(key, i));
+                ref.insert(std::make_pair(key, i));
+            }
+        }
+        const auto first = static_cast<int>(g() % 500);
+        const int last = first + static_cast<int>(g() % 50);
+        auto next = m.erase(m.lower_bound(first), m.lower_bound(last));
+        ref.erase(ref.lower_bound(first), ref.lower_bound(last));
+        EXPECT_EQ(next, m.lower_bound(last));
+        ASSERT_EQ(m.size(), ref.size());
+    }
+    auto it = m.begin();
+    for (const auto &[key, value] : ref) {
+        EXPECT_EQ(it->first, key);
+        EXPECT_EQ(it->second, value);
+        ++it;
+    }
+    EXPECT_EQ(it, m.end());
+}
+
+TEST(RangeErase, MultimapSplitsBetweenDuplicates) {
+    bst::multimap<int, int> m;
+    for (int i = 0; i < 30; i++) {
+        m.insert(std::make_pair(i / 10, i));
+    }
+    // Erase the last 5 elements with key 0 and the first 5 with key 1
+    auto first = std::next(m.begin(), 5);
+    auto last = std::next(m.begin(), 15);
+    EXPECT_EQ(m.erase(first, last), last);
+    EXPECT_EQ(m.size(), 20);
+    EXPECT_EQ(m.count(0), 5);
+    EXPECT_EQ(m.count(1), 5);
+    EXPECT_EQ(m.count(2), 10);
+    int expected = 0;
+    for (auto it = m.begin(); it != m.end(); ++it, ++expected) {
+        expected += expected == 5 ? 10 : 0;
+        EXPECT_EQ(it->second, expected);
+    }
+}
+
+TEST(ExtractRange, MovesNodesIntoNewTreap) {
+    bst::treap_map<int, int> m;
+    for (int i = 0; i < 100; i++) {
+        m[i] = i;
+    }
+    auto it = m.find(30);
+    auto part = m.extract_range(m.lower_bound(25), m.lower_bound(75));
+    EXPECT_EQ(m.size(), 50);
+    EXPECT_EQ(part.size(), 50);
+    EXPECT_EQ(part.begin()->first, 25);
+    EXPECT_EQ(std::prev(part.end())->first, 74);
+    EXPECT_EQ(it, part.find(30));
+    EXPECT_EQ(m.find(30), m.end());
+    EXPECT_EQ(std::next(m.find(24))->first, 75);
+    EXPECT_EQ(std::distance(part.begin(), part.end()), 50);
+    // Both are complete treaps of their own
+    part[1000] = 0;
+    m.erase(0);
+    EXPECT_EQ(std::prev(part.end())->first, 1000);
+    EXPECT_EQ(m.begin()->first, 1);
+
+    auto rest = m.extract_range(m.begin(), m.end());
+    EXPECT_TRUE(m.empty());
+    EXPECT_EQ(rest.size(), 49);
+    EXPECT_TRUE(m.extract_range(m.begin(), m.end()).empty());
+}
+
+TEST(ExtractRange, MultimapKeepsSubtreeSizes) {
+    bst::multimap<int, int> m;
+    for (int i = 0; i < 100; i++) {
+        m.insert(std::make_pair(i % 10, i));
+    }
+    auto part = m.extract_range(m.lower_bound(3), m.upper_bound(5));
+    EXPECT_EQ(part.size(), 30);
+    EXPECT_EQ(m.size(), 70);
+    for (int key = 0; key < 10; key++) {
+        EXPECT_EQ(m.count(key), key >= 3 && key <= 5 ? 0 : 10);
+        EXPECT_EQ(part.count(key), key >= 3 && key <= 5 ? 10 : 0);
+    }
+}
+
+}
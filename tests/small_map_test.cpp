@@ -0,0 +1,161 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#include <functional> // std::less
+#include <iterator>   // std::prev
+#include <map>        // std::map
+#include <random>     // std::minstd_rand
+#include <set>        // std::set
+#include <string>     // std::string, std::to_string
+#include <utility>    // std::make_pair, std::move, std::pair
+
+#include <gtest/gtest.h>
+
+#include "../src/small_map.h"
+#include "../src/stats_alloc.h"
+
+namespace {
+
+template<class Map, class Ref>
+void expect_same(const Map &m, const Ref &ref) {
+    EXPECT_EQ(m.size(), ref.size());
+    auto it = m.begin();
+    for (const auto &value : ref) {
+        ASSERT_NE(it, m.end());
+        EXPECT_EQ(*it, value);
+        ++it;
+    }
+    EXPECT_EQ(it, m.end());
+    for (auto rit = ref.rbegin(); rit != ref.rend(); ++rit) {
+        EXPECT_EQ(*--it, *rit);
+    }
+    EXPECT_EQ(it, m.begin());
+}
+
+TEST(SmallMap, RandomAgainstStdMap) {
+    // Few enough keys that the map keeps growing past its slots and
+    // shrinking back into them
+    bst::small_map<int, int, 8> m;
+    std::map<int, int> ref;
+    std::minstd_rand g;
+    for (int i = 0; i < 20000; i++) {
+        const int key = static_cast<int>(g() % 24);
+        switch (g() % 4) {
+            case 0:
+                EXPECT_EQ(m.erase(key), ref.erase(key));
+                break;
+            case 1:
+                if (const auto it = ref.lower_bound(key); it != ref.end()) {
+                    const auto next = m.erase(m.lower_bound(key));
+                    const auto ref_next = ref.erase(it);
+                    ASSERT_EQ(next == m.end(), ref_next == ref.end());
+                    if (ref_next != ref.end()) {
+                        EXPECT_EQ(next->first, ref_next->first);
+                    }
+                }
+                break;
+            default: {
+                const int value = static_cast<int>(g());
+                EXPECT_EQ(m.insert(std::make_pair(key, value)).second, ref.insert(std::make_pair(key, value)).second);
+                m[key] = value;
+                ref[key] = value;
+            }
+        }
+        ASSERT_EQ(m.size(), ref.size());
+        EXPECT_EQ(m.count(key), ref.count(key));
+        const auto lo = m.lower_bound(key);
+        EXPECT_EQ(lo == m.end(), ref.lower_bound(key) == ref.end());
+        const auto hi = m.upper_bound(key);
+        EXPECT_EQ(hi == m.end(), ref.upper_bound(key) == ref.end());
+        if (i % 100 == 0) {
+            expect_same(m, ref);
+        }
+    }
+}
+
+TEST(SmallMap, StaysInlineUntilItOutgrowsItsSlots) {
+    struct inline_tag {};
+    using alloc = bst::stats_allocator<std::pair<const int, int>, inline_tag>;
+    {
+        bst::small_map<int, int, 8, std::less<int>, alloc> m;
+        for (int i = 7; i >= 0; i--) {
+            m[i] = i;
+        }
+        m.erase(3);
+        m[3] = 3;
+        EXPECT_EQ(m.size(), 8);
+        EXPECT_EQ(alloc::stats().allocations, 0);
+        EXPECT_EQ(m.memory_usage(), sizeof(m));
+
+        m[8] = 8;
+        EXPECT_EQ(alloc::stats().allocations, 9);
+        EXPECT_GT(m.memory_usage(), sizeof(m));
+        // Back into the slots at half size
+        for (int i = 0; i < 5; i++) {
+            m.erase(i);
+        }
+        EXPECT_EQ(alloc::stats().live_bytes, 0);
+        EXPECT_EQ(m.begin()->first, 5);
+        EXPECT_EQ(std::prev(m.end())->first, 8);
+        m[0] = 0;
+        EXPECT_EQ(alloc::stats().allocations, 9);
+    }
+    EXPECT_EQ(alloc::stats().live_bytes, 0);
+}
+
+TEST(SmallMap, EraseReturnsTheNextElementAcrossShrinking) {
+    bst::small_map<int, int, 4> m;
+    for (int i = 0; i < 5; i++) {
+        m[i] = i;
+    }
+    EXPECT_EQ(m.erase(m.find(1))->first, 2);
+    EXPECT_EQ(m.erase(m.find(2))->first, 3);
+    // Moves back into the slots, so end() has to be taken afterwards
+    const auto next = m.erase(m.find(4));
+    EXPECT_EQ(next, m.end());
+    EXPECT_EQ(m.size(), 2);
+    EXPECT_EQ(m.begin()->first, 0);
+}
+
+TEST(SmallMap, StringSet) {
+    bst::small_set<std::string, 4> s;
+    std::set<std::string> ref;
+    for (int i = 0; i < 10; i++) {
+        const std::string key = "key " + std::to_string(i % 6);
+        EXPECT_EQ(s.insert(key).second, ref.insert(key).second);
+        expect_same(s, ref);
+    }
+    EXPECT_NE(s.find("key 3"), s.end());
+    EXPECT_EQ(s.find("key 9"), s.end());
+    s.clear();
+    EXPECT_TRUE(s.empty());
+    EXPECT_EQ(s.begin(), s.end());
+}
+
+TEST(SmallMap, CopyMoveAndSwap) {
+    bst::small_map<std::string, int, 4> small;
+    bst::small_map<std::string, int, 4> big;
+    for (int i = 0; i < 3; i++) {
+        small[std::to_string(i)] = i;
+    }
+    for (int i = 0; i < 10; i++) {
+        big[std::to_string(i)] = i;
+    }
+    bst::small_map<std::string, int, 4> copy(small);
+    EXPECT_EQ(copy.size(), 3);
+    EXPECT_EQ(copy.find("2")->second, 2);
+    copy = big;
+    EXPECT_EQ(copy.size(), 10);
+    EXPECT_EQ(big.size(), 10);
+
+    bst::small_map<std::string, int, 4> moved(std::move(copy));
+    EXPECT_EQ(moved.size(), 10);
+    moved.swap(small);
+    EXPECT_EQ(moved.size(), 3);
+    EXPECT_EQ(small.size(), 10);
+    EXPECT_EQ(std::prev(small.end())->first, "9");
+    EXPECT_EQ(std::prev(moved.end())->first, "2");
+}
+
+}
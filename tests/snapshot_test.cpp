@@ -0,0 +1,195 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#include <cstdint>  // std::uint32_t, std::uint64_t
+#include <cstdio>   // std::FILE, std::fclose, std::tmpfile, fileno
+#include <cstring>  // std::memcpy
+#include <iterator> // std::prev
+#include <random>   // std::minstd_rand
+#include <sstream>  // std::stringstream
+#include <string>   // std::string, std::to_string
+#include <utility>  // std::make_pair
+
+#include <unistd.h> // SEEK_SET, lseek
+
+#include <gtest/gtest.h>
+
+#include "../src/bst.h"
+
+namespace {
+
+template<class Tree>
+std::string save(const Tree &tree) {
+    std::stringstream out;
+    tree.save(out);
+    return out.str();
+}
+
+template<class Tree>
+void load(Tree &tree, const std::string &snapshot) {
+    std::stringstream in(snapshot);
+    tree.load(in);
+}
+
+TEST(Snapshot, RoundTripKeepsShape) {
+    bst::treap_map<int, int> m;
+    std::minstd_rand g;
+    for (int i = 0; i < 10000; i++) {
+        m[static_cast<int>(g() % 100000)] = i;
+    }
+    bst::treap_map<int, int> loaded;
+    loaded[-1] = -1;
+    load(loaded, save(m));
+    EXPECT_EQ(loaded.size(), m.size());
+    EXPECT_EQ(loaded.shape().depth_histogram, m.shape().depth_histogram);
+    auto it = loaded.begin();
+    for (auto ref = m.begin(); ref != m.end(); ++ref, ++it) {
+        ASSERT_NE(it, loaded.end());
+        EXPECT_EQ(it->first, ref->first);
+        EXPECT_EQ(it->second, ref->second);
+    }
+    EXPECT_EQ(it, loaded.end());
+    // Saving it again gives back the same bytes, priorities included
+    EXPECT_EQ(save(loaded), save(m));
+    // And it is still a working treap
+    loaded.erase(m.begin()->first);
+    loaded[100000] = 0;
+    EXPECT_EQ(loaded.size(), m.size());
+    EXPECT_EQ(std::prev(loaded.end())->first, 100000);
+}
+
+TEST(Snapshot, StringKeys) {
+    bst::treap_map<std::string, std::string> m;
+    for (int i = 0; i < 1000; i++) {
+        m["key " + std::to_string(i)] = std::string(i % 50, 'x');
+    }
+    bst::treap_map<std::string, std::string> loaded;
+    load(loaded, save(m));
+    EXPECT_EQ(loaded.size(), 1000);
+    for (int i = 0; i < 1000; i++) {
+        auto it = loaded.find("key " + std::to_string(i));
+        ASSERT_NE(it, loaded.end());
+        EXPECT_EQ(it->second, std::string(i % 50, 'x'));
+    }
+}
+
+TEST(Snapshot, SetsAndMultimaps) {
+    bst::treap_set<int> s;
+    bst::multimap<int, int> mm;
+    for (int i = 0; i < 100; i++) {
+        s.insert(i);
+        mm.insert(std::make_pair(i % 10, i));
+    }
+    bst::treap_set<int> loaded_s;
+    load(loaded_s, save(s));
+    EXPECT_EQ(loaded_s.size(), 100);
+    EXPECT_EQ(*loaded_s.begin(), 0);
+    EXPECT_EQ(*std::prev(loaded_s.end()), 99);
+
+    bst::multimap<int, int> loaded_mm;
+    load(loaded_mm, save(mm));
+    EXPECT_EQ(loaded_mm.size(), 100);
+    // Subtree sizes are rebuilt
+    EXPECT_EQ(loaded_mm.count(3), 10);
+    EXPECT_EQ(loaded_mm.erase(3), 10);
+    EXPECT_EQ(loaded_mm.size(), 90);
+}
+
+TEST(Snapshot, EmptyTree) {
+    bst::treap_map<int, int> m;
+    bst::treap_map<int, int> loaded;
+    loaded[1] = 1;
+    load(loaded, save(m));
+    EXPECT_TRUE(loaded.empty());
+    EXPECT_EQ(loaded.begin(), loaded.end());
+}
+
+TEST(Snapshot, FileDescriptors) {
+    bst::treap_map<int, int> m;
+    for (int i = 0; i < 100000; i++) {
+        m[i * 7 % 100000] = i;
+    }
+    std::FILE *const file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    const int fd = fileno(file);
+    m.save(fd);
+    ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+    bst::treap_map<int, int> loaded;
+    loaded.load(fd);
+    EXPECT_EQ(save(loaded), save(m));
+    // Nothing left to read
+    EXPECT_THROW(loaded.load(fd), bst::snapshot_error);
+    EXPECT_EQ(loaded.size(), m.size());
+    std::fclose(file);
+}
+
+// Equal priorities pass the heap order check, so a snapshot can describe a
+// chain as deep as it has nodes
+TEST(Snapshot, DeepChainDoesNotRecurse) {
+    constexpr std::uint32_t count = 1000000;
+    std::string snapshot = save(bst::treap_map<int, int>());
+    // The element count ends the header
+    const std::uint64_t stored_count = count;
+    std::memcpy(&snapshot[snapshot.size() - sizeof stored_count], &stored_count, sizeof stored_count);
+    for (std::uint32_t i = 0; i < count; i++) {
+        const unsigned char flags = i + 1 < count ? 2 : 0; // A right child, but the last
+        const std::uint32_t pri = 1;
+        const int key = static_cast<int>(i);
+        snapshot += static_cast<char>(flags);
+        snapshot.append(reinterpret_cast<const char *>(&pri), sizeof pri);
+        snapshot.append(reinterpret_cast<const char *>(&key), sizeof key);
+        snapshot.append(reinterpret_cast<const char *>(&key), sizeof key);
+    }
+    bst::treap_map<int, int> loaded;
+    load(loaded, snapshot);
+    EXPECT_EQ(loaded.size(), count);
+    EXPECT_EQ(loaded.shape().height, count);
+    EXPECT_EQ(std::prev(loaded.end())->first, static_cast<int>(count) - 1);
+    EXPECT_EQ(save(loaded), snapshot);
+
+    // Copying goes down the chain without recursing either
+    const bst::treap_map<int, int> copy(loaded);
+    EXPECT_EQ(copy.shape().height, count);
+    EXPECT_EQ(save(copy), snapshot);
+}
+
+TEST(Snapshot, BadSnapshotsLeaveTreeAlone) {
+    bst::treap_map<int, int> m;
+    for (int i = 0; i < 1000; i++) {
+        m[i] = i;
+    }
+    const std::string snapshot = save(m);
+    bst::treap_map<int, int> target;
+    target[7] = 7;
+    const auto expect_unchanged = [&] {
+        EXPECT_EQ(target.size(), 1);
+        EXPECT_EQ(target.begin()->first, 7);
+    };
+
+    std::string bad_magic = snapshot;
+    bad_magic[0] = 'X';
+    EXPECT_THROW(load(target, bad_magic), bst::snapshot_error);
+    expect_unchanged();
+
+    EXPECT_THROW(load(target, snapshot.substr(0, snapshot.size() / 2)), bst::snapshot_error);
+    expect_unchanged();
+
+    EXPECT_THROW(load(target, snapshot.substr(0, 10)), bst::snapshot_error);
+    expect_unchanged();
+
+    // Other mapped type
+    bst::treap_map<int, long long> other;
+    EXPECT_THROW(load(other, snapshot), bst::snapshot_error);
+    EXPECT_TRUE(other.empty());
+
+    // Multi snapshots don't load into unique trees
+    bst::multiset<int> ms;
+    ms.insert(1);
+    ms.insert(1);
+    bst::treap_set<int> s;
+    EXPECT_THROW(load(s, save(ms)), bst::snapshot_error);
+    EXPECT_TRUE(s.empty());
+}
+
+}
@@ -0,0 +1,114 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+#include <thread> // std::thread
+#include <vector> // std::vector
+
+#include <gtest/gtest.h>
+
+#include "../src/bst.h"
+#include "../src/stats_alloc.h"
+
+namespace {
+
+// Each test has a tag of its own, so their counters start from 0
+struct counts_tag {};
+struct threads_tag {};
+struct usage_tag {};
+struct clear_tag {};
+
+TEST(StatsAlloc, CountsBytesPeakAndSizes) {
+    using alloc = bst::stats_allocator<int, counts_tag>;
+    alloc a;
+    int *small = a.allocate(1);
+    int *big = a.allocate(100);
+    a.deallocate(small, 1);
+    int *medium = a.allocate(10);
+
+    auto stats = alloc::stats();
+    EXPECT_EQ(stats.live_bytes, 110 * sizeof(int));
+    EXPECT_EQ(stats.peak_bytes, 110 * sizeof(int));
+    EXPECT_EQ(stats.allocations, 3);
+    EXPECT_EQ(stats.deallocations, 1);
+    EXPECT_EQ(stats.histogram[2], 1); // 4 bytes
+    EXPECT_EQ(stats.histogram[6], 1); // 40 bytes
+    EXPECT_EQ(stats.histogram[9], 1); // 400 bytes
+
+    a.deallocate(big, 100);
+    alloc::reset_stats();
+    stats = alloc::stats();
+    EXPECT_EQ(stats.live_bytes, 10 * sizeof(int));
+    EXPECT_EQ(stats.peak_bytes, 10 * sizeof(int));
+    EXPECT_EQ(stats.allocations, 0);
+    a.deallocate(medium, 10);
+    EXPECT_EQ(alloc::stats().live_bytes, 0);
+}
+
+TEST(StatsAlloc, SumsOverThreads) {
+    using alloc = bst::stats_allocator<long, threads_tag>;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([] {
+            alloc a;
+            for (int i = 0; i < 1000; i++) {
+                a.deallocate(a.allocate(2), 2);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    const auto stats = alloc::stats();
+    EXPECT_EQ(stats.allocations, 4000);
+    EXPECT_EQ(stats.deallocations, 4000);
+    EXPECT_EQ(stats.live_bytes, 0);
+    EXPECT_GE(stats.peak_bytes, 2 * sizeof(long));
+}
+
+TEST(StatsAlloc, MemoryUsageMatchesAllocatedNodes) {
+    using alloc = bst::stats_allocator<std::pair<const int, int>, usage_tag>;
+    bst::treap_map<int, int, std::less<int>, alloc> m;
+    const std::size_t empty_usage = m.memory_usage();
+    for (int i = 0; i < 1000; i++) {
+        m[i] = i;
+    }
+    EXPECT_EQ(alloc::stats().allocations, 1000);
+    EXPECT_EQ(m.memory_usage() - empty_usage, alloc::stats().live_bytes);
+    for (int i = 0; i < 500; i++) {
+        m.erase(i);
+    }
+    EXPECT_EQ(m.memory_usage() - empty_usage, alloc::stats().live_bytes);
+}
+
+TEST(StatsAlloc, ClearFreesEveryNode) {
+    using alloc = bst::stats_allocator<std::pair<const int, int>, clear_tag>;
+    bst::rb_map<int, int, std::less<int>, alloc> m;
+    for (int i = 0; i < 10000; i++) {
+        m[i] = i;
+    }
+    m.clear();
+    EXPECT_TRUE(m.empty());
+    EXPECT_EQ(m.size(), 0);
+    EXPECT_EQ(alloc::stats().live_bytes, 0);
+    EXPECT_EQ(alloc::stats().deallocations, 10000);
+    m[1] = 1;
+    EXPECT_EQ(m.begin()->first, 1);
+
+    {
+        bst::thread_pool pool(2);
+        bst::treap_map<int, int, std::less<int>, alloc> t;
+        for (int i = 0; i < 10000; i++) {
+            t[i] = i;
+        }
+        t.clear_async(pool);
+        EXPECT_TRUE(t.empty());
+        EXPECT_EQ(t.begin(), t.end());
+        t[2] = 2;
+        EXPECT_EQ(t.size(), 1);
+        // The pool frees what is left to free before it goes
+    }
+    EXPECT_EQ(alloc::stats().deallocations, 20001);
+}
+
+}
@@ -0,0 +1,118 @@
+// © 2023 Bill Chow. All rights reserved.
+// Unauthorized use, modification, or distribution of this code is strictly
+// prohibited.
+
+// Built into its own test binary with BST_STATS=1, as turning stats on
+// changes the layout of every tree
+
+#include <numeric> // std::accumulate
+
+#include <gtest/gtest.h>
+
+#include "../src/bst.h"
+
+namespace {
+
+static_assert(BST_STATS != 0, "stats_test has to be built with BST_STATS=1");
+
+template<class Map>
+class TreeStats : public testing::Test {};
+
+using map_types = testing::Types<bst::treap_map<int, int>, bst::avl_map<int, int>, bst::rb_map<int, int>,
+                                 bst::scapegoat_map<int, int>>;
+
+TYPED_TEST_SUITE(TreeStats, map_types);
+
+TYPED_TEST(TreeStats, CountsAllocationsAndLookups) {
+    TypeParam m;
+    for (int i = 0; i < 100; i++) {
+        m[i] = i;
+    }
+    EXPECT_EQ(m.stats().allocations, 100);
+    EXPECT_EQ(m.stats().deallocations, 0);
+
+    m.reset_stats();
+    std::ignore = m.lower_bound(42);
+    const auto stats = m.stats();
+    EXPECT_GE(stats.nodes_visited, 1);
+    EXPECT_LE(stats.nodes_visited, m.shape().height);
+    EXPECT_EQ(stats.comparisons, stats.nodes_visited);
+    EXPECT_EQ(stats.rotations, 0);
+
+    m.erase(42);
+    EXPECT_EQ(m.stats().deallocations, 1);
+}
+
+TYPED_TEST(TreeStats, ShapeAddsUp) {
+    TypeParam m;
+    EXPECT_EQ(m.shape().height, 0);
+    for (int i = 0; i < 1000; i++) {
+        m[i] = i;
+    }
+    const auto shape = m.shape();
+    EXPECT_EQ(shape.size, 1000);
+    EXPECT_EQ(shape.height, shape.depth_histogram.size());
+    EXPECT_EQ(std::accumulate(shape.depth_histogram.begin(), shape.depth_histogram.end(), std::size_t{0}), 1000);
+    EXPECT_EQ(shape.depth_histogram[0], 1);
+    // A perfectly balanced tree of 1000 nodes is 10 high
+    EXPECT_GE(shape.height, 10);
+    EXPECT_LT(shape.height, 60);
+    EXPECT_GE(shape.average_path, 1);
+    EXPECT_LE(shape.average_path, static_cast<double>(shape.height));
+
+    // The average successful find() visits average_path nodes
+    m.reset_stats();
+    for (int i = 0; i < 1000; i++) {
+        std::ignore = m.lower_bound(i);
+    }
+    EXPECT_LE(static_cast<double>(m.stats().nodes_visited) / 1000, static_cast<double>(shape.height));
+}
+
+TEST(TreeStats, TreapRotationsAndMergeDepth) {
+    bst::treap_map<int, int> m;
+    for (int i = 0; i < 1000; i++) {
+        m[i] = i;
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        m.erase(i);
+    }
+    const auto stats = m.stats();
+    EXPECT_GT(stats.rotations, 0);
+    EXPECT_GE(stats.merge_steps, 500);
+    EXPECT_GE(stats.max_merge_depth, 1);
+    EXPECT_LE(stats.max_merge_depth, 2 * 60);
+}
+
+TEST(TreeStats, FilterTurnsMostMissesAway) {
+    bst::filtered_map<int, int> m;
+    for (int i = 0; i < 10000; i++) {
+        m[2 * i] = i;
+    }
+    EXPECT_TRUE(m.contains(0));
+    m.reset_stats();
+    for (int i = 0; i < 10000; i++) {
+        EXPECT_EQ(m.find(2 * i + 1), m.end());
+    }
+    // About 1 in 40 misses gets through the filter
+    EXPECT_LT(m.stats().nodes_visited, 10000 * m.shape().height / 10);
+    m.reset_stats();
+    for (int i = 0; i < 10000; i++) {
+        EXPECT_EQ(m.count(2 * i), 1);
+    }
+    EXPECT_GE(m.stats().nodes_visited, 10000);
+}
+
+TEST(TreeStats, IndexAnswersFindsWithoutTheTree) {
+    bst::indexed_map<int, int> m;
+    for (int i = 0; i < 1000; i++) {
+        m[i] = i;
+    }
+    m.reset_stats();
+    for (int i = 0; i < 2000; i++) {
+        EXPECT_EQ(m.count(i), i < 1000);
+    }
+    m[5] = 6;
+    EXPECT_EQ(m.stats().nodes_visited, 0);
+}
+
+}